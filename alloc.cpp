@@ -0,0 +1,152 @@
+#include "alloc.h"
+
+#include <algorithm>
+
+// Creates an allocator where every block is in use
+Allocator::Allocator() : blockCount(0), freeCount(0), hint(0) {}
+
+// Marks every block as in use and resizes the bitmap
+void Allocator::reset(size_t blocks) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->blockCount = blocks;
+    this->freeCount = 0;
+    this->bits.assign((blocks + 63) / 64, 0);
+    this->summary.assign((this->bits.size() + 63) / 64, 0);
+    this->hint = this->summary.size();
+}
+
+// Marks a block as free
+void Allocator::release(uint32_t block) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->setFree(block);
+}
+
+// Marks a block as in use
+void Allocator::take(uint32_t block) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->setUsed(block);
+}
+
+// Marks a block as free and its word as having free space
+void Allocator::setFree(uint32_t block) {
+    if (block >= this->blockCount || this->freeBit(block)) return;
+    size_t word = block / 64;
+    this->bits[word] |= uint64_t(1) << (block % 64);
+    this->summary[word / 64] |= uint64_t(1) << (word % 64);
+    if (word / 64 < this->hint) this->hint = word / 64;
+    this->freeCount++;
+}
+
+// Marks a block as in use, clearing the summary bit when its word becomes full
+void Allocator::setUsed(uint32_t block) {
+    if (block >= this->blockCount || !this->freeBit(block)) return;
+    size_t word = block / 64;
+    this->bits[word] &= ~(uint64_t(1) << (block % 64));
+    if (this->bits[word] == 0) this->summary[word / 64] &= ~(uint64_t(1) << (word % 64));
+    this->freeCount--;
+}
+
+// Takes the lowest free block by finding the first summary word with a free word in it
+int32_t Allocator::allocate() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->freeCount == 0) return -1;
+
+    // Words before the hint are known to be full so the search starts there
+    while (this->summary[this->hint] == 0) this->hint++;
+    size_t word = this->hint * 64 + __builtin_ctzll(this->summary[this->hint]);
+    uint32_t block = word * 64 + __builtin_ctzll(this->bits[word]);
+
+    this->setUsed(block);
+    return block;
+}
+
+// Takes the first free block at or after hint, wrapping around to the start of the disk
+int32_t Allocator::allocateNear(uint32_t hint) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    size_t block = this->findFree(hint);
+    if (block == this->blockCount) block = this->findFree(0);
+    if (block == this->blockCount) return -1;
+
+    this->setUsed(block);
+    return block;
+}
+
+// Takes count blocks as one contiguous run if possible, otherwise the longest runs so the file has as few extents
+// as possible
+bool Allocator::allocateExtents(uint32_t count, uint32_t hint, std::vector<Extent>& extents) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    extents.clear();
+    if (count == 0) return true;
+    if (count > this->freeCount) return false;
+    if (hint >= this->blockCount) hint = 0;
+
+    // Walks the free runs from hint to the end of the disk and then from the start of the disk to hint
+    std::vector<Extent> runs;
+    size_t bounds[2][2] = {{hint, this->blockCount}, {0, hint}};
+    for (auto& bound : bounds) {
+        size_t start = this->findFree(bound[0]);
+        while (start < bound[1]) {
+            // A run is only followed as far as count blocks, so a large free area costs no more than the request
+            size_t end = this->findUsed(start, std::min<size_t>(start + count, bound[1]));
+
+            // The first run that is long enough is used as is
+            if (end - start >= count) {
+                runs.assign(1, Extent{uint32_t(start), count});
+                break;
+            }
+            runs.push_back(Extent{uint32_t(start), uint32_t(end - start)});
+            start = this->findFree(end);
+        }
+        if (runs.size() == 1 && runs[0].length == count) break;
+    }
+
+    // Otherwise the longest runs are used first, ties are broken by the distance from hint
+    if (runs.size() != 1 || runs[0].length != count) {
+        std::stable_sort(runs.begin(), runs.end(),
+                         [](const Extent& a, const Extent& b) { return a.length > b.length; });
+    }
+
+    uint32_t left = count;
+    for (const Extent& run : runs) {
+        if (left == 0) break;
+        Extent extent{run.start, std::min(run.length, left)};
+        for (uint32_t i = 0; i < extent.length; i++) this->setUsed(extent.start + i);
+        extents.push_back(extent);
+        left -= extent.length;
+    }
+    return true;
+}
+
+// Finds the first free block at or after from, skipping full words with the summary bitmap
+size_t Allocator::findFree(size_t from) const {
+    size_t word = from / 64;
+    if (word >= this->bits.size()) return this->blockCount;
+
+    uint64_t bitsLeft = this->bits[word] & (~uint64_t(0) << (from % 64));
+    if (bitsLeft) return word * 64 + __builtin_ctzll(bitsLeft);
+
+    for (word++; word < this->bits.size();) {
+        uint64_t wordsLeft = this->summary[word / 64] & (~uint64_t(0) << (word % 64));
+        if (wordsLeft) {
+            word = (word / 64) * 64 + __builtin_ctzll(wordsLeft);
+            return word * 64 + __builtin_ctzll(this->bits[word]);
+        }
+        word = (word / 64 + 1) * 64;
+    }
+    return this->blockCount;
+}
+
+// Finds the first block in use at or after from and before limit, the padding after the last block counts as in use
+size_t Allocator::findUsed(size_t from, size_t limit) const {
+    limit = std::min(limit, this->blockCount);
+    size_t word = from / 64;
+    if (from >= limit) return limit;
+
+    uint64_t bitsLeft = ~this->bits[word] & (~uint64_t(0) << (from % 64));
+    if (bitsLeft) return std::min<size_t>(word * 64 + __builtin_ctzll(bitsLeft), limit);
+
+    for (word++; word * 64 < limit; word++) {
+        if (~this->bits[word]) return std::min<size_t>(word * 64 + __builtin_ctzll(~this->bits[word]), limit);
+    }
+    return limit;
+}
@@ -0,0 +1,105 @@
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+/// @brief In-memory free-space bitmap over the blocks of the disk.
+/// A summary level keeps one bit per bitmap word so that the lowest free block is found with two ctz instructions,
+/// no matter how full the disk is. Every call is atomic, the FAT releases the free entries of the blocks it loads from
+/// whichever thread loads them.
+class Allocator {
+   public:
+    /// @brief A run of consecutive blocks.
+    struct Extent {
+        uint32_t start;
+        uint32_t length;
+    };
+
+    /// @brief Creates an allocator where every block is in use.
+    Allocator();
+
+    /// @brief Marks every block as in use and resizes the bitmap.
+    /// @param blocks Amount of blocks on the disk.
+    void reset(size_t blocks);
+
+    /// @brief Marks a block as free.
+    /// @param block The block to free.
+    void release(uint32_t block);
+
+    /// @brief Marks a block as in use.
+    /// @param block The block to take.
+    void take(uint32_t block);
+
+    /// @brief Takes the lowest free block.
+    /// @return The block or -1 if the disk is full.
+    int32_t allocate();
+
+    /// @brief Takes the first free block at or after hint, wrapping around to the start of the disk.
+    /// @param hint The block to start looking at.
+    /// @return The block or -1 if the disk is full.
+    int32_t allocateNear(uint32_t hint);
+
+    /// @brief Takes count blocks as one contiguous run if possible, otherwise as few runs as possible.
+    /// Runs at or after hint are preferred, wrapping around to the start of the disk.
+    /// @param count Amount of blocks to take.
+    /// @param hint The block to start looking at.
+    /// @param extents The runs that were taken, in the order they should be used.
+    /// @return True if succeeded else false, in which case nothing is taken.
+    bool allocateExtents(uint32_t count, uint32_t hint, std::vector<Extent>& extents);
+
+    /// @return True if the block is free else false.
+    inline bool isFree(uint32_t block) const {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->freeBit(block);
+    }
+
+    /// @return Amount of free blocks.
+    inline size_t freeBlocks() const {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->freeCount;
+    }
+
+    /// @return Amount of blocks tracked by the allocator.
+    inline size_t blocks() const {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->blockCount;
+    }
+
+   private:
+    /// @return True if the block is free else false.
+    inline bool freeBit(uint32_t block) const { return (this->bits[block / 64] >> (block % 64)) & 1; }
+
+    /// @brief Marks a block as free, the caller holds the lock.
+    void setFree(uint32_t block);
+
+    /// @brief Marks a block as in use, the caller holds the lock.
+    void setUsed(uint32_t block);
+
+    /// @brief Finds the first free block at or after from.
+    /// @return The block or blocks() if there is none.
+    size_t findFree(size_t from) const;
+
+    /// @brief Finds the first block in use at or after from, looking no further than limit.
+    /// @return The block or limit if there is none before it.
+    size_t findUsed(size_t from, size_t limit) const;
+
+    size_t blockCount;
+    size_t freeCount;
+
+    // One bit per block, set if the block is free
+    std::vector<uint64_t> bits;
+
+    // One bit per word in bits, set if the word has at least one free block
+    std::vector<uint64_t> summary;
+
+    // No summary word before this index has a free block
+    size_t hint;
+
+    // Guards everything above
+    mutable std::mutex lock;
+};
+
+#endif  // __ALLOC_H__
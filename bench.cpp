@@ -0,0 +1,240 @@
+// Microbenchmarks of the file system operations: every scenario formats a fresh volume, runs one operation many times
+// and times each call. The disk blocks read and written are counted from the first call until the volume has been
+// synced after the last one, so blocks the cache writes back later are charged to the operation that dirtied them.
+// Prints one JSON document with the operations per second, latency percentiles and disk blocks per operation of
+// every scenario. The disk file lives in a scratch directory that is removed at the end.
+//
+// Usage: bench [--backend pread|mmap|uring] [--ops count]
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "disk.h"
+#include "fs.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Blocks of the volume every scenario formats, with 32-bit FAT entries
+static const uint32_t VOLUME_BLOCKS = 131072;
+// Most file data one size scenario creates, larger files are created fewer times
+static const size_t DATA_BUDGET = 64u << 20;
+
+/// @brief Reads straight from a buffer without copying it, so preparing the data of create costs nothing.
+class MemoryBuf : public std::streambuf {
+   public:
+    MemoryBuf(const char* data, size_t size) {
+        char* start = const_cast<char*>(data);
+        this->setg(start, start, start + size);
+    }
+};
+
+/// @brief Throws away everything written to it, so ls is timed without the cost of a real stream.
+class NullBuf : public std::streambuf {
+   protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+/// @brief Latencies and disk traffic of one scenario.
+struct Result {
+    std::string op;
+    std::string params;           // JSON members describing the scenario
+    std::vector<double> latency;  // microseconds per call
+    double seconds;               // time spent in the calls
+    uint64_t reads;               // disk blocks read
+    uint64_t writes;              // disk blocks written
+    size_t errors;                // calls that didn't return 0
+};
+
+static std::vector<Result> results;
+
+// Times count calls of an operation and syncs the volume before the disk traffic is counted
+static void measure(FS& fs, const std::string& op, const std::string& params, size_t count,
+                    const std::function<int(size_t)>& call) {
+    Result result{op, params, {}, 0, 0, 0, 0};
+    result.latency.reserve(count);
+    Disk::Stats before = fs.diskStats();
+    for (size_t i = 0; i < count; i++) {
+        auto start = Clock::now();
+        if (call(i)) result.errors++;
+        double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        result.latency.push_back(elapsed);
+        result.seconds += elapsed / 1e6;
+    }
+    fs.sync();
+    Disk::Stats after = fs.diskStats();
+    result.reads = after.reads - before.reads;
+    result.writes = after.writes - before.writes;
+    results.push_back(result);
+}
+
+static std::string name(const char* prefix, size_t i) { return prefix + std::to_string(i); }
+
+// Formats volumes of every FAT width
+static void benchFormat(FS& fs, size_t ops) {
+    const uint32_t sizes[][2] = {{2048, 16}, {32000, 16}, {VOLUME_BLOCKS, 32}};
+    for (auto& size : sizes) {
+        std::string params = "\"blocks\": " + std::to_string(size[0]) + ", \"fat_bits\": " + std::to_string(size[1]);
+        measure(fs, "format", params, std::max<size_t>(5, ops / 20),
+                [&](size_t) { return fs.format(size[0], size[1]); });
+    }
+}
+
+// Runs every file operation over files of one size, each operation on the files the one before it left
+static void benchFiles(FS& fs, size_t ops, int devNull) {
+    const size_t sizes[] = {64, 4096, 65536, 1u << 20};
+    for (size_t size : sizes) {
+        size_t count = std::max<size_t>(8, std::min(ops, DATA_BUDGET / size));
+        std::string params = "\"size\": " + std::to_string(size);
+        std::string data(size, 'x');
+        fs.format(VOLUME_BLOCKS, 32);
+
+        measure(fs, "create", params, count, [&](size_t i) {
+            MemoryBuf buffer(data.data(), data.size());
+            std::istream input(&buffer);
+            return fs.create(name("f", i), input, true);
+        });
+        measure(fs, "cat", params, count, [&](size_t i) { return fs.cat(name("f", i), devNull); });
+        measure(fs, "cp", params, count, [&](size_t i) { return fs.cp(name("f", i), name("c", i)); });
+        measure(fs, "append", params, count, [&](size_t i) { return fs.append(name("f", i), name("c", i)); });
+        measure(fs, "mv", params, count, [&](size_t i) { return fs.mv(name("c", i), name("m", i)); });
+        measure(fs, "chmod", params, count, [&](size_t i) { return fs.chmod("4", name("m", i)); });
+        measure(fs, "rm", params, count, [&](size_t i) { return fs.rm(name("f", i)); });
+    }
+}
+
+// Lists, creates and removes entries in directories of growing fan-out
+static void benchFanOut(FS& fs, size_t ops) {
+    const size_t fanOuts[] = {16, 256, 2048};
+    std::string data(64, 'x');
+    NullBuf discard;
+    std::ostream out(&discard);
+    for (size_t fanOut : fanOuts) {
+        std::string params = "\"fanout\": " + std::to_string(fanOut);
+        fs.format(VOLUME_BLOCKS, 32);
+        for (size_t i = 0; i < fanOut; i++) {
+            MemoryBuf buffer(data.data(), data.size());
+            std::istream input(&buffer);
+            fs.create(name("e", i), input, true);
+        }
+        fs.sync();
+
+        measure(fs, "ls", params, ops, [&](size_t) { return fs.ls(out); });
+        measure(fs, "create", params, ops, [&](size_t i) {
+            MemoryBuf buffer(data.data(), data.size());
+            std::istream input(&buffer);
+            return fs.create(name("n", i), input, true);
+        });
+        measure(fs, "rm", params, ops, [&](size_t i) { return fs.rm(name("n", i)); });
+    }
+}
+
+// Makes and enters directories at the bottom of trees of growing depth
+static void benchDepth(FS& fs, size_t ops) {
+    const size_t depths[] = {1, 8, 32};
+    for (size_t depth : depths) {
+        std::string params = "\"depth\": " + std::to_string(depth);
+        fs.format(VOLUME_BLOCKS, 32);
+        std::string bottom;
+        for (size_t i = 0; i < depth; i++) {
+            bottom += "/d";
+            fs.mkdir(bottom);
+        }
+        fs.sync();
+
+        measure(fs, "mkdir", params, ops, [&](size_t i) { return fs.mkdir(bottom + name("/x", i)); });
+        measure(fs, "cd", params, ops, [&](size_t i) { return fs.cd(bottom + name("/x", i)); });
+        fs.cd("/");
+    }
+}
+
+// Returns the value below which a share of the sorted values lie
+static double percentile(const std::vector<double>& sorted, double share) {
+    size_t index = std::min(sorted.size() - 1, size_t(share * sorted.size()));
+    return sorted[index];
+}
+
+static void print(const std::string& backend, size_t ops) {
+    std::printf("{\n  \"backend\": \"%s\",\n  \"ops\": %zu,\n  \"results\": [\n", backend.c_str(), ops);
+    for (size_t i = 0; i < results.size(); i++) {
+        Result& result = results[i];
+        std::vector<double>& sorted = result.latency;
+        std::sort(sorted.begin(), sorted.end());
+        double count = sorted.size();
+        std::printf(
+            "    {\"op\": \"%s\", %s, \"count\": %zu, \"errors\": %zu, \"ops_per_sec\": %.1f, \"p50_us\": %.2f, "
+            "\"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, \"disk_reads_per_op\": %.3f, "
+            "\"disk_writes_per_op\": %.3f}%s\n",
+            result.op.c_str(), result.params.c_str(), sorted.size(), result.errors,
+            result.seconds > 0 ? count / result.seconds : 0.0, percentile(sorted, 0.50), percentile(sorted, 0.90),
+            percentile(sorted, 0.99), sorted.back(), result.reads / count, result.writes / count,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    std::string backend = "pread";
+    size_t ops = 200;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc)
+            backend = argv[++i];
+        else if (arg == "--ops" && i + 1 < argc)
+            ops = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        else {
+            std::cerr << "Usage: bench [--backend pread|mmap|uring] [--ops count]\n";
+            return 1;
+        }
+    }
+    Disk::Backend diskBackend;
+    if (backend == "pread")
+        diskBackend = Disk::PREAD;
+    else if (backend == "mmap")
+        diskBackend = Disk::MMAP;
+    else if (backend == "uring")
+        diskBackend = Disk::URING;
+    else {
+        std::cerr << "Unknown backend " << backend << "\n";
+        return 1;
+    }
+
+    // The disk file is made here so that FS has nothing to say on stdout
+    char scratch[] = "/tmp/fsbench.XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch)) {
+        std::cerr << "Can't make a scratch directory\n";
+        return 1;
+    }
+    {
+        std::ofstream disk(DISKNAME, std::ios::binary);
+        disk.seekp((uint64_t)DEFAULT_NO_BLOCKS * BLOCK_SIZE - 1);
+        disk.write("", 1);
+    }
+    int devNull = open("/dev/null", O_WRONLY);
+
+    {
+        FS fs(diskBackend);
+        benchFormat(fs, ops);
+        benchFiles(fs, ops, devNull);
+        benchFanOut(fs, ops);
+        benchDepth(fs, ops);
+    }
+    print(backend, ops);
+
+    close(devNull);
+    unlink(DISKNAME);
+    if (chdir("/") == 0) rmdir(scratch);
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// Binds the cache to a disk
+BlockCache::BlockCache(Disk* disk, size_t capacity)
+    : disk(disk), journal(nullptr), maxBlocks(capacity ? capacity : 1), counters{} {}
+
+// Writes back every dirty block before the cache is destroyed
+BlockCache::~BlockCache() { this->flush(); }
+
+// Reads one block through the cache
+int BlockCache::read(unsigned block_no, uint8_t* blk) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->passThrough()) {
+        this->counters.hits++;
+        return this->disk->read(block_no, blk);
+    }
+
+    FrameIt frame = this->lookup(block_no, true);
+    if (frame == this->frames.end()) return -1;
+    std::memcpy(blk, frame->data->data(), BLOCK_SIZE);
+    return 0;
+}
+
+// Reads part of one block, either from the mapped disk file or from a cache frame
+int BlockCache::read(unsigned block_no, size_t offset, size_t length, uint8_t* out) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->passThrough()) {
+        const uint8_t* data = this->disk->block(block_no);
+        if (!data) return -1;
+        this->counters.hits++;
+        std::memcpy(out, data + offset, length);
+        return 0;
+    }
+
+    FrameIt frame = this->lookup(block_no, true);
+    if (frame == this->frames.end()) return -1;
+    std::memcpy(out, frame->data->data() + offset, length);
+    return 0;
+}
+
+// Shares the cached block with the caller, a block of the mapping is copied since it may change under the caller
+BlockCache::View BlockCache::view(unsigned block_no) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->passThrough()) {
+        std::shared_ptr<Block> blk = std::make_shared<Block>();
+        this->counters.hits++;
+        if (this->disk->read(block_no, blk->data())) return nullptr;
+        return blk;
+    }
+
+    FrameIt frame = this->lookup(block_no, true);
+    if (frame == this->frames.end()) return nullptr;
+    return frame->data;
+}
+
+// Writes one block to the cache and marks it dirty, the disk is written on eviction or flush
+int BlockCache::write(unsigned block_no, const uint8_t* blk) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->store(block_no, blk);
+}
+
+// Changes part of one block, the block is read first so the rest of it is kept
+int BlockCache::write(unsigned block_no, size_t offset, size_t length, const uint8_t* data) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->passThrough()) {
+        std::array<uint8_t, BLOCK_SIZE> blk;
+        if (this->disk->read(block_no, blk.data())) return -1;
+        std::memcpy(blk.data() + offset, data, length);
+        this->counters.hits++;
+        return this->disk->write(block_no, blk.data());
+    }
+
+    FrameIt frame = this->lookup(block_no, true);
+    if (frame == this->frames.end()) return -1;
+    std::memcpy(this->own(*frame, true) + offset, data, length);
+    frame->dirty = true;
+    return 0;
+}
+
+// Writes one block to the cache and marks it dirty
+int BlockCache::store(unsigned block_no, const uint8_t* blk) {
+    if (block_no >= this->disk->get_no_blocks()) {
+        std::cout << "BlockCache::write - ERROR: Invalid block number (" << block_no << ")\n";
+        return -1;
+    }
+
+    // Writes to the mapping are already write-back, the kernel decides when they reach the disk file
+    if (this->passThrough()) {
+        this->counters.hits++;
+        return this->disk->write(block_no, (uint8_t*)blk);
+    }
+
+    // The whole block is overwritten so there is no reason to read it on a miss
+    FrameIt frame = this->lookup(block_no, false);
+    std::memcpy(this->own(*frame, false), blk, BLOCK_SIZE);
+    frame->dirty = true;
+    return 0;
+}
+
+// Reads many blocks, cached blocks are copied and the rest are read from the disk with as few requests as possible
+int BlockCache::readv(const std::vector<Disk::BlockIO>& ios) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    if (this->passThrough()) {
+        this->counters.hits += ios.size();
+        guard.unlock();
+        return this->disk->readv(ios);
+    }
+
+    // Cached and journaled blocks may be newer than the disk so they are copied from the cache or the journal, the
+    // rest is read without holding the cache
+    std::vector<Disk::BlockIO> missing;
+    for (const Disk::BlockIO& io : ios) {
+        auto found = this->index.find(io.block_no);
+        if (found != this->index.end()) {
+            this->counters.hits++;
+            std::memcpy(io.blk, found->second->data->data(), BLOCK_SIZE);
+        } else if (this->journal && this->journal->read(io.block_no, io.blk)) {
+            this->counters.hits++;
+        } else {
+            this->counters.misses++;
+            missing.push_back(io);
+        }
+    }
+    guard.unlock();
+    return missing.empty() ? 0 : this->disk->readv(missing);
+}
+
+// Writes many blocks straight to the disk, cached copies are updated and become clean since the disk now has them
+int BlockCache::writev(const std::vector<Disk::BlockIO>& ios) {
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    // A journaled copy would overwrite the new data when written home, so the committed transactions are written
+    // home first. The running one is left alone since it may hold half of an operation that hasn't ended, and a block
+    // freed by an operation is only reused once the transaction that freed it is committed.
+    if (this->journal) {
+        for (const Disk::BlockIO& io : ios) {
+            if (!this->journal->contains(io.block_no)) continue;
+            this->journal->checkpoint();
+            break;
+        }
+    }
+
+    if (!this->passThrough()) {
+        for (const Disk::BlockIO& io : ios) {
+            auto found = this->index.find(io.block_no);
+            if (found == this->index.end()) continue;
+            std::memcpy(this->own(*found->second, false), io.blk, BLOCK_SIZE);
+            found->second->dirty = false;
+        }
+    }
+    guard.unlock();
+    return this->disk->writev(ios);
+}
+
+// Sends blocks straight from the disk unless a dirty frame or the journal holds a newer copy of one of them
+uint64_t BlockCache::send(int out_fd, unsigned first, unsigned count, uint64_t length) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    for (unsigned block_no = first; block_no < first + count; block_no++) {
+        auto found = this->index.find(block_no);
+        if (found != this->index.end() && found->second->dirty) return 0;
+        if (this->journal && this->journal->contains(block_no)) return 0;
+    }
+    guard.unlock();
+    return this->disk->send_range(out_fd, first, length);
+}
+
+// Writes every dirty block back to the disk in block order and syncs the disk
+int BlockCache::flush() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->flushLocked();
+}
+
+// Writes the dirty blocks in block order
+int BlockCache::flushLocked() {
+    // Sorting the dirty blocks makes the writes as sequential as possible
+    std::vector<Frame*> dirty;
+    for (Frame& frame : this->frames)
+        if (frame.dirty) dirty.push_back(&frame);
+    std::sort(dirty.begin(), dirty.end(), [](const Frame* a, const Frame* b) { return a->block_no < b->block_no; });
+
+    // The journal decides when the blocks are committed and written home
+    int ret = 0;
+    for (Frame* frame : dirty) {
+        if (this->journal)
+            this->journal->log(frame->block_no, frame->data->data());
+        else if (this->disk->write(frame->block_no, frame->data->data()))
+            ret = -1;
+        frame->dirty = false;
+        this->counters.writebacks++;
+    }
+    if (!this->journal && this->disk->sync()) ret = -1;
+    return ret;
+}
+
+// Flushes the dirty blocks to wherever they went so far and starts over with an empty cache
+void BlockCache::setJournal(Journal* journal) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->flushLocked();
+    this->frames.clear();
+    this->index.clear();
+    this->journal = journal;
+}
+
+// Drops every cached block without writing it back
+void BlockCache::invalidate() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->frames.clear();
+    this->index.clear();
+}
+
+// Changes the maximum amount of cached blocks, evicting blocks if needed
+void BlockCache::resize(size_t capacity) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->maxBlocks = capacity ? capacity : 1;
+    this->evict(this->maxBlocks);
+}
+
+// Finds the frame for a block and marks it as most recently used, loading it on a miss
+BlockCache::FrameIt BlockCache::lookup(unsigned block_no, bool load) {
+    auto found = this->index.find(block_no);
+    if (found != this->index.end()) {
+        this->counters.hits++;
+        this->frames.splice(this->frames.begin(), this->frames, found->second);
+        return found->second;
+    }
+
+    // Makes room for the new block before reading it in
+    this->counters.misses++;
+    this->evict(this->maxBlocks - 1);
+    this->frames.emplace_front();
+    FrameIt frame = this->frames.begin();
+    frame->block_no = block_no;
+    frame->dirty = false;
+    frame->data = std::make_shared<Block>();
+
+    if (load && this->load(block_no, frame->data->data())) {
+        this->frames.pop_front();
+        return this->frames.end();
+    }
+    this->index[block_no] = frame;
+    return frame;
+}
+
+// A view made under the lock is the only way the count goes up, so a stale count only costs a needless copy
+uint8_t* BlockCache::own(Frame& frame, bool keep) {
+    if (frame.data.use_count() > 1) frame.data = keep ? std::make_shared<Block>(*frame.data) : std::make_shared<Block>();
+    return frame.data->data();
+}
+
+// Reads a block from the journal if it has a copy, otherwise from the disk
+int BlockCache::load(unsigned block_no, uint8_t* blk) {
+    if (this->journal && this->journal->read(block_no, blk)) return 0;
+    return this->disk->read(block_no, blk);
+}
+
+// Evicts least recently used blocks until the cache holds at most capacity blocks
+void BlockCache::evict(size_t capacity) {
+    FrameIt next = this->frames.end();
+    while (this->frames.size() > capacity && next != this->frames.begin()) {
+        FrameIt victim = std::prev(next);
+
+        // A journaled operation must reach the journal as a whole, so its dirty blocks wait for flush()
+        if (victim->dirty && this->journal) {
+            next = victim;
+            continue;
+        }
+        if (victim->dirty) {
+            this->disk->write(victim->block_no, victim->data->data());
+            this->counters.writebacks++;
+        }
+        this->index.erase(victim->block_no);
+        this->frames.erase(victim);
+        this->counters.evictions++;
+    }
+}
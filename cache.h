@@ -0,0 +1,186 @@
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "disk.h"
+#include "journal.h"
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+// Default amount of blocks kept in memory by the block cache
+#define CACHE_BLOCKS 256
+
+/// @brief Write-back LRU cache of disk blocks that sits between the file system and the disk.
+/// When the disk is memory mapped the mapping already is the cache, so blocks are accessed in place instead.
+/// With a journal attached, dirty blocks are handed to the journal on flush instead of being written home.
+/// Every call is atomic, and vectored transfers of file data reach the disk without holding the cache.
+class BlockCache {
+   public:
+    typedef std::array<uint8_t, BLOCK_SIZE> Block;
+
+    /// @brief A block looked at without copying it. The block stays as it was for as long as the view is held, a
+    /// block that is changed meanwhile gets a copy of its own in the cache.
+    typedef std::shared_ptr<const Block> View;
+
+    /// @brief Counters describing how well the cache is doing.
+    struct Stats {
+        uint64_t hits;        // reads and writes served by a cached block
+        uint64_t misses;      // reads and writes that had to load or allocate a block
+        uint64_t evictions;   // blocks dropped to make room for another block
+        uint64_t writebacks;  // dirty blocks written to the disk
+    };
+
+    /// @brief Binds the cache to a disk.
+    /// @param disk The disk to cache.
+    /// @param capacity Maximum amount of blocks to keep in memory.
+    BlockCache(Disk* disk, size_t capacity = CACHE_BLOCKS);
+
+    /// @brief Writes back every dirty block before the cache is destroyed.
+    ~BlockCache();
+
+    /// @brief Reads one block through the cache.
+    /// @param block_no The block to read.
+    /// @param blk BLOCK_SIZE buffer to put the block in.
+    /// @return 0 if succeeded else -1.
+    int read(unsigned block_no, uint8_t* blk);
+
+    /// @brief Reads part of one block through the cache.
+    /// @param block_no The block to read.
+    /// @param offset Where in the block to start.
+    /// @param length Amount of bytes to read, offset + length is at most BLOCK_SIZE.
+    /// @param out Buffer of length bytes to put the data in.
+    /// @return 0 if succeeded else -1.
+    int read(unsigned block_no, size_t offset, size_t length, uint8_t* out);
+
+    /// @brief Gives read access to a block without copying it. When the disk is mapped and no journal is attached
+    /// the block is copied, since the mapping is changed in place.
+    /// @param block_no The block to look at.
+    /// @return The block, or nullptr on failure.
+    View view(unsigned block_no);
+
+    /// @brief Writes one block to the cache and marks it dirty.
+    /// @param block_no The block to write.
+    /// @param blk BLOCK_SIZE buffer to write.
+    /// @return 0 if succeeded else -1.
+    int write(unsigned block_no, const uint8_t* blk);
+
+    /// @brief Changes part of one block in the cache and marks it dirty, the rest of the block is kept.
+    /// @param block_no The block to write.
+    /// @param offset Where in the block to start.
+    /// @param length Amount of bytes to write, offset + length is at most BLOCK_SIZE.
+    /// @param data Buffer of length bytes to write.
+    /// @return 0 if succeeded else -1.
+    int write(unsigned block_no, size_t offset, size_t length, const uint8_t* data);
+
+    /// @brief Reads many blocks, cached blocks are copied and the rest are read from the disk with as few requests
+    /// as possible. Blocks read this way are not added to the cache so large files don't push out metadata.
+    /// @param ios The blocks to read and where to put them.
+    /// @return 0 if succeeded else -1.
+    int readv(const std::vector<Disk::BlockIO>& ios);
+
+    /// @brief Writes many blocks straight to the disk with as few requests as possible, cached copies are updated.
+    /// @param ios The blocks to write and where to take them from.
+    /// @return 0 if succeeded else -1.
+    int writev(const std::vector<Disk::BlockIO>& ios);
+
+    /// @brief Sends consecutive blocks straight from the disk to a file descriptor without copying them, which is
+    /// only possible if the disk has the newest copy of every block.
+    /// @param out_fd The file descriptor to write to.
+    /// @param first The first block to send.
+    /// @param count Amount of blocks in the run.
+    /// @param length Amount of bytes to send, at most count * BLOCK_SIZE.
+    /// @return Amount of bytes sent, the caller copies the rest itself.
+    uint64_t send(int out_fd, unsigned first, unsigned count, uint64_t length);
+
+    /// @brief Writes every dirty block back to the disk in block order and syncs the disk, or logs them in the
+    /// journal if one is attached.
+    /// @return 0 if succeeded else -1.
+    int flush();
+
+    /// @brief Sends dirty blocks to a journal from now on, dirty blocks then only leave the cache through flush().
+    /// Whatever is dirty is flushed first and the cache is emptied.
+    /// @param journal The journal, or nullptr to write blocks home again.
+    void setJournal(Journal* journal);
+
+    /// @brief Drops every cached block without writing it back.
+    void invalidate();
+
+    /// @brief Changes the maximum amount of cached blocks, evicting blocks if needed.
+    /// @param capacity New maximum amount of blocks, at least 1.
+    void resize(size_t capacity);
+
+    /// @return Maximum amount of blocks kept in memory.
+    inline size_t capacity() const { return this->maxBlocks; }
+
+    /// @return Amount of blocks currently in memory.
+    inline size_t size() const {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->index.size();
+    }
+
+    /// @return The cache counters.
+    inline const Stats& stats() const { return this->counters; }
+
+    /// @brief Sets every cache counter to zero.
+    inline void resetStats() { this->counters = Stats{}; }
+
+   private:
+    /// @return True if blocks are accessed in the mapped disk file instead of being cached.
+    inline bool passThrough() const { return this->disk->is_mapped() && !this->journal; }
+
+    /// @brief Writes a block, the caller holds the lock.
+    /// @return 0 if succeeded else -1.
+    int store(unsigned block_no, const uint8_t* blk);
+
+    /// @brief Flushes the dirty blocks, the caller holds the lock.
+    /// @return 0 if succeeded else -1.
+    int flushLocked();
+
+    /// @brief Reads a block that is not cached, from the journal if it has a newer copy than the disk.
+    /// @return 0 if succeeded else -1.
+    int load(unsigned block_no, uint8_t* blk);
+
+    /// @brief One cached block.
+    struct Frame {
+        unsigned block_no;
+        bool dirty;
+        std::shared_ptr<Block> data;  // shared with the views of the block
+    };
+
+    typedef std::list<Frame>::iterator FrameIt;
+
+    /// @brief Gives a frame a block of its own before it is changed, the views of the block keep the old one.
+    /// @param frame The frame about to be changed.
+    /// @param keep Whether the contents are copied, a block that is overwritten as a whole needs no copy.
+    /// @return The block to change.
+    uint8_t* own(Frame& frame, bool keep);
+
+    /// @brief Finds the frame for a block and marks it as most recently used.
+    /// @param block_no The block to look for.
+    /// @param load Whether the block should be read from disk on a miss.
+    /// @return Iterator to the frame, or frames.end() if the disk read failed.
+    FrameIt lookup(unsigned block_no, bool load);
+
+    /// @brief Evicts least recently used blocks until the cache is below its capacity.
+    /// @param capacity Amount of blocks allowed after eviction.
+    void evict(size_t capacity);
+
+    Disk* disk;
+    Journal* journal;
+    size_t maxBlocks;
+    Stats counters;
+
+    // Most recently used frame first
+    std::list<Frame> frames;
+    std::unordered_map<unsigned, FrameIt> index;
+
+    // Guards everything above, the journal is only called with it held
+    mutable std::mutex lock;
+};
+
+#endif  // __CACHE_H__
@@ -0,0 +1,56 @@
+#include "dcache.h"
+
+// Creates an empty cache
+DentryCache::DentryCache(size_t capacity) : maxEntries(capacity ? capacity : 1), counters{}, changes(0) {}
+
+// Looks up a resolved path, a miss hands out the current generation
+bool DentryCache::lookup(const std::string& key, Dentry& dentry, uint64_t& generation) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto found = this->entries.find(key);
+    if (found == this->entries.end()) {
+        this->counters.misses++;
+        generation = this->changes;
+        return false;
+    }
+    this->counters.hits++;
+    dentry = found->second;
+    return true;
+}
+
+// Remembers a resolved path and the directories it depends on
+void DentryCache::insert(const std::string& key, const Dentry& dentry, const std::vector<int32_t>& dirs,
+                         uint64_t generation) {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    // A directory that changed while the path was resolved may have been read before the change
+    if (generation != this->changes) return;
+
+    // Starting over is cheaper than tracking which path was used least recently
+    if (this->entries.size() >= this->maxEntries) {
+        this->entries.clear();
+        this->dependents.clear();
+    }
+
+    this->entries[key] = dentry;
+    for (int32_t dir : dirs) this->dependents[dir].push_back(key);
+}
+
+// Drops every path that was resolved through the directory
+void DentryCache::invalidate(int32_t dir) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->changes++;
+    auto found = this->dependents.find(dir);
+    if (found == this->dependents.end()) return;
+
+    // Paths that were already dropped through another directory are skipped by erase
+    for (const std::string& key : found->second) this->counters.invalidations += this->entries.erase(key);
+    this->dependents.erase(found);
+}
+
+// Drops every path
+void DentryCache::clear() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->changes++;
+    this->entries.clear();
+    this->dependents.clear();
+}
@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "direntry.h"
+
+#ifndef __DCACHE_H__
+#define __DCACHE_H__
+
+// Default maximum amount of resolved paths kept by the dentry cache
+#define DENTRY_CACHE_SIZE 4096
+
+/// @brief Cache of resolved paths, including paths that don't exist.
+/// Every path remembers the directories it was resolved through, and is dropped as soon as one of them changes.
+/// Every call is atomic. A path resolved while a directory changed is not remembered, so a walk that raced with the
+/// change can't bring an outdated result back.
+class DentryCache {
+   public:
+    /// @brief The result of resolving a path.
+    struct Dentry {
+        bool found;       // whether the path could be resolved
+        dir_entry entry;  // the entry the path resolved to
+        std::string last; // the last component when only the path up to it was resolved
+    };
+
+    /// @brief Counters describing how well the cache is doing.
+    struct Stats {
+        uint64_t hits;           // lookups answered by the cache
+        uint64_t misses;         // lookups that had to walk the directory tree
+        uint64_t invalidations;  // paths dropped because a directory they went through changed
+    };
+
+    /// @brief Creates an empty cache.
+    /// @param capacity Maximum amount of paths to keep, the cache starts over when it is full.
+    DentryCache(size_t capacity = DENTRY_CACHE_SIZE);
+
+    /// @brief Looks up a resolved path.
+    /// @param key The path, made absolute by the caller.
+    /// @param dentry The cached result.
+    /// @param generation Set to the generation to pass to insert() if the path has not been resolved.
+    /// @return True if the path has been resolved else false.
+    bool lookup(const std::string& key, Dentry& dentry, uint64_t& generation);
+
+    /// @brief Remembers a resolved path unless a directory changed since lookup() missed it.
+    /// @param key The path, made absolute by the caller.
+    /// @param dentry The result of resolving the path.
+    /// @param dirs First blocks of the directories the path was resolved through.
+    /// @param generation The generation lookup() gave before the path was resolved.
+    void insert(const std::string& key, const Dentry& dentry, const std::vector<int32_t>& dirs, uint64_t generation);
+
+    /// @brief Drops every path that was resolved through a directory.
+    /// @param dir First block of the directory that changed.
+    void invalidate(int32_t dir);
+
+    /// @brief Drops every path.
+    void clear();
+
+    /// @return The cache counters.
+    inline const Stats& stats() const { return this->counters; }
+
+    /// @brief Sets every cache counter to zero.
+    inline void resetStats() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->counters = Stats{};
+    }
+
+   private:
+    size_t maxEntries;
+    Stats counters;
+
+    // Counts the changes to directories
+    uint64_t changes;
+    std::unordered_map<std::string, Dentry> entries;
+
+    // The paths that were resolved through each directory
+    std::unordered_map<int32_t, std::vector<std::string>> dependents;
+
+    // Guards everything above
+    std::mutex lock;
+};
+
+#endif  // __DCACHE_H__
@@ -5,9 +5,38 @@
 struct dir_entry {
     char file_name[56];     // name of the file / sub-directory
     uint32_t size;          // size of the file in bytes
-    uint16_t first_blk;     // index in the FAT for the first block of the file
+    uint16_t first_blk;     // index in the FAT for the first block of the file,
+                            // on 32-bit FAT volumes the upper half is in
+                            // file_name[54..55]
     uint8_t type;           // directory (1) or file (0)
     uint8_t access_rights;  // read (0x04), write (0x02), execute (0x01)
 };
 
-#endif
\ No newline at end of file
+// "BTRE" in a little-endian word, marks the header and the nodes of a directory stored as a B-tree
+#define DIR_TREE_MAGIC 0x45525442
+
+// Kept in slot 2 of the first block of a directory stored as a B-tree, after the "." and ".." entries. It starts with
+// a zero byte so that it reads as a free entry.
+struct dir_tree_header {
+    uint32_t zero;    // always 0
+    uint32_t magic;   // DIR_TREE_MAGIC
+    uint32_t root;    // block of the root node, never 0 since that is the root directory
+    uint32_t last;    // last block in the chain of the directory, where new nodes are linked
+    uint32_t count;   // amount of entries in the tree
+    uint32_t height;  // levels of nodes, 1 while the root is a leaf
+    uint32_t unused[10];
+};
+
+// Kept in slot 0 of every node block of a B-tree directory. The slots after it hold count records sorted by name,
+// dir_entry records in a leaf and keys in an inner node. A key is a dir_entry holding the smallest name its child
+// may hold and the block of the child in size, the first key of the leftmost node on a level has an empty name.
+struct dir_tree_node {
+    uint32_t zero;   // always 0
+    uint32_t magic;  // DIR_TREE_MAGIC
+    uint32_t leaf;   // 1 for a leaf, 0 for an inner node
+    uint32_t count;  // amount of records in the node
+    uint32_t next;   // next leaf in name order, 0 after the last one
+    uint32_t unused[11];
+};
+
+#endif
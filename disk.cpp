@@ -1,32 +1,101 @@
 #include "disk.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
-Disk::Disk() {
+thread_local Disk::Stats *Disk::thread_stats = nullptr;
+
+Disk::Disk(Backend backend, unsigned queue_depth)
+    : map(nullptr), dirty_lo(-1u), dirty_hi(0), use_map(backend == MMAP),
+      blocks_read(0), blocks_written(0) {
     // first check if the disk file exists, otherwise create it.
     if (!disk_file_exists(DISKNAME)) {
         std::cout << "No disk file found...\n";
         std::cout << "Creating disk file: " << DISKNAME << std::endl;
         std::ofstream f(DISKNAME, std::ios::binary | std::ios::out);
-        f.seekp((1 << 23) - 1);
+        f.seekp((uint64_t)DEFAULT_NO_BLOCKS * BLOCK_SIZE - 1);
         f.write("", 1);
     }
     // the disk is simulated as a binary file
-    diskfile.open(DISKNAME, std::ios::in | std::ios::out | std::ios::binary);
-    if (!diskfile.is_open()) {
+    fd = open(DISKNAME, O_RDWR);
+    if (fd == -1) {
         std::cerr << "ERROR: Can't open diskfile: " << DISKNAME
                   << ", exiting..." << std::endl;
         exit(-1);
     }
+    // the size of the disk is the size of the disk file
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        std::cerr << "ERROR: Can't stat diskfile: " << DISKNAME
+                  << ", exiting..." << std::endl;
+        exit(-1);
+    }
+    no_blocks = st.st_size / BLOCK_SIZE;
+    disk_size = (uint64_t)no_blocks * BLOCK_SIZE;
+    map_disk();
+    if (backend == URING && !ring.open(fd, queue_depth))
+        std::cout << "Disk - WARNING: io_uring unavailable, using "
+                     "pread/pwrite\n";
 }
 
-Disk::~Disk() { diskfile.close(); }
+Disk::~Disk() {
+    if (map) {
+        sync();
+        munmap(map, disk_size);
+    }
+    ring.close();
+    close(fd);
+}
 
 bool Disk::disk_file_exists(const std::string &name) {
     std::ifstream f(name.c_str());
     return f.good();
 }
 
+// maps the whole disk file, falls back to pread/pwrite if that fails
+void Disk::map_disk() {
+    map = nullptr;
+    if (!use_map || disk_size == 0) return;
+    void *addr =
+        mmap(nullptr, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED)
+        map = (uint8_t *)addr;
+    else
+        std::cout << "Disk - WARNING: mmap failed, using pread/pwrite\n";
+}
+
+// grows or shrinks the disk file and maps it again
+int Disk::resize(unsigned blocks) {
+    if (blocks == no_blocks) return 0;
+    if (map) {
+        sync();
+        munmap(map, disk_size);
+        map = nullptr;
+    }
+    int ret = ftruncate(fd, (off_t)blocks * BLOCK_SIZE);
+    if (ret == 0) no_blocks = blocks;
+    disk_size = (uint64_t)no_blocks * BLOCK_SIZE;
+    dirty_lo = -1u;
+    dirty_hi = 0;
+    map_disk();
+    return ret;
+}
+
+// returns a pointer to a block inside the mapped disk file
+uint8_t *Disk::block(unsigned block_no) {
+    if (!map || block_no >= no_blocks) return nullptr;
+    return map + (size_t)block_no * BLOCK_SIZE;
+}
+
 // writes one block to the disk
 int Disk::write(unsigned block_no, uint8_t *blk) {
     if (DEBUG) std::cout << "Disk::write(" << block_no << ")\n";
@@ -42,10 +111,14 @@ int Disk::write(unsigned block_no, uint8_t *blk) {
         std::cout << "\n";
     }
 
-    unsigned offset = block_no * BLOCK_SIZE;
-    diskfile.seekp(offset, std::ios_base::beg);
-    diskfile.write((char *)blk, BLOCK_SIZE);
-    diskfile.flush();
+    count(1, true);
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (map) {
+        std::memcpy(map + offset, blk, BLOCK_SIZE);
+        mark_dirty(block_no, block_no);
+        return 0;
+    }
+    if (pwrite(fd, blk, BLOCK_SIZE, offset) != BLOCK_SIZE) return -1;
     return 0;
 }
 
@@ -58,8 +131,217 @@ int Disk::read(unsigned block_no, uint8_t *blk) {
                   << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
-    diskfile.seekg(offset, std::ios_base::beg);
-    diskfile.read((char *)blk, BLOCK_SIZE);
+    count(1, false);
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (map) {
+        std::memcpy(blk, map + offset, BLOCK_SIZE);
+        return 0;
+    }
+    if (pread(fd, blk, BLOCK_SIZE, offset) != BLOCK_SIZE) return -1;
     return 0;
 }
+
+// reads a list of blocks, consecutive block numbers share a system call
+int Disk::readv(const std::vector<BlockIO> &ios) { return transfer(ios, false); }
+
+// writes a list of blocks, consecutive block numbers share a system call
+int Disk::writev(const std::vector<BlockIO> &ios) { return transfer(ios, true); }
+
+// reads count consecutive blocks starting at first into blk
+int Disk::read_range(unsigned first, unsigned count, uint8_t *blk) {
+    std::vector<BlockIO> ios(count);
+    for (unsigned i = 0; i < count; i++)
+        ios[i] = BlockIO{first + i, blk + (size_t)i * BLOCK_SIZE};
+    return transfer(ios, false);
+}
+
+// writes count consecutive blocks starting at first from blk
+int Disk::write_range(unsigned first, unsigned count, uint8_t *blk) {
+    std::vector<BlockIO> ios(count);
+    for (unsigned i = 0; i < count; i++)
+        ios[i] = BlockIO{first + i, blk + (size_t)i * BLOCK_SIZE};
+    return transfer(ios, true);
+}
+
+// sorts the blocks and moves every run of consecutive block numbers at once
+int Disk::transfer(std::vector<BlockIO> ios, bool is_write) {
+    if (DEBUG)
+        std::cout << "Disk::" << (is_write ? "writev" : "readv") << "("
+                  << ios.size() << " blocks)\n";
+    for (const BlockIO &io : ios) {
+        if (io.block_no >= no_blocks) {
+            std::cout << "Disk::" << (is_write ? "writev" : "readv")
+                      << " - ERROR: Invalid block number (" << io.block_no
+                      << ")\n";
+            return -1;
+        }
+    }
+    count(ios.size(), is_write);
+    std::stable_sort(ios.begin(), ios.end(),
+                     [](const BlockIO &a, const BlockIO &b) {
+                         return a.block_no < b.block_no;
+                     });
+
+    // runs[k] is the first block of run k, the last entry ends the last run
+    std::vector<unsigned> runs{0};
+    for (unsigned i = 1; i <= ios.size(); i++) {
+        if (i < ios.size() && ios[i].block_no == ios[i - 1].block_no + 1 &&
+            i - runs.back() < IOV_MAX)
+            continue;
+        runs.push_back(i);
+    }
+    if (ring.enabled() && !map) return transfer_ring(ios, runs, is_write, false);
+
+    int ret = 0;
+    for (unsigned k = 0; k + 1 < runs.size(); k++) {
+        if (transfer_run(&ios[runs[k]], runs[k + 1] - runs[k], is_write))
+            ret = -1;
+    }
+    return ret;
+}
+
+// builds one io_uring request per run and keeps as many of them in flight
+// as the queue depth allows
+int Disk::transfer_ring(const std::vector<BlockIO> &ios,
+                        const std::vector<unsigned> &runs, bool is_write,
+                        bool linked) {
+    std::vector<struct iovec> iov(ios.size());
+    for (unsigned i = 0; i < ios.size(); i++)
+        iov[i] = iovec{ios[i].blk, BLOCK_SIZE};
+    std::vector<IoRing::Request> requests;
+    for (unsigned k = 0; k + 1 < runs.size(); k++) {
+        unsigned count = runs[k + 1] - runs[k];
+        requests.push_back(IoRing::Request{
+            is_write, (uint64_t)ios[runs[k]].block_no * BLOCK_SIZE,
+            &iov[runs[k]], count, (size_t)count * BLOCK_SIZE});
+    }
+
+    // whatever io_uring didn't move completely is redone in order
+    std::vector<bool> done;
+    int ret = 0;
+    if (ring.run(requests, linked, done) == 0) return 0;
+    for (unsigned k = 0; k + 1 < runs.size(); k++) {
+        if (!done[k] &&
+            transfer_run(&ios[runs[k]], runs[k + 1] - runs[k], is_write))
+            ret = -1;
+    }
+    return ret;
+}
+
+// writes every group after the one before it, runs keep the order they
+// have in the groups
+int Disk::write_ordered(const std::vector<std::vector<BlockIO>> &groups) {
+    std::vector<BlockIO> ios;
+    std::vector<unsigned> runs{0};
+    for (const std::vector<BlockIO> &group : groups) {
+        for (const BlockIO &io : group) {
+            if (io.block_no >= no_blocks) {
+                std::cout << "Disk::write_ordered - ERROR: Invalid block "
+                             "number ("
+                          << io.block_no << ")\n";
+                return -1;
+            }
+            if (!ios.empty() && ios.size() != runs.back() &&
+                (io.block_no != ios.back().block_no + 1 ||
+                 ios.size() - runs.back() >= IOV_MAX))
+                runs.push_back(ios.size());
+            ios.push_back(io);
+        }
+        if (ios.size() != runs.back()) runs.push_back(ios.size());
+    }
+    if (ios.empty()) return 0;
+    count(ios.size(), true);
+    if (ring.enabled() && !map) return transfer_ring(ios, runs, true, true);
+
+    // one system call at a time already keeps the order
+    int ret = 0;
+    for (unsigned k = 0; k + 1 < runs.size(); k++) {
+        if (transfer_run(&ios[runs[k]], runs[k + 1] - runs[k], true))
+            ret = -1;
+    }
+    return ret;
+}
+
+// moves one run of consecutive blocks with a single preadv/pwritev
+int Disk::transfer_run(const BlockIO *ios, unsigned count, bool is_write) {
+    off_t offset = (off_t)ios[0].block_no * BLOCK_SIZE;
+    if (map) {
+        for (unsigned i = 0; i < count; i++) {
+            if (is_write)
+                std::memcpy(map + offset + (size_t)i * BLOCK_SIZE, ios[i].blk,
+                            BLOCK_SIZE);
+            else
+                std::memcpy(ios[i].blk, map + offset + (size_t)i * BLOCK_SIZE,
+                            BLOCK_SIZE);
+        }
+        if (is_write) mark_dirty(ios[0].block_no, ios[count - 1].block_no);
+        return 0;
+    }
+
+    std::vector<struct iovec> iov(count);
+    for (unsigned i = 0; i < count; i++)
+        iov[i] = iovec{ios[i].blk, BLOCK_SIZE};
+    ssize_t expected = (ssize_t)count * BLOCK_SIZE;
+    ssize_t done = is_write ? pwritev(fd, iov.data(), count, offset)
+                            : preadv(fd, iov.data(), count, offset);
+    if (done == expected) return 0;
+
+    // a short transfer is redone one block at a time, the blocks are
+    // already counted
+    int ret = 0;
+    for (unsigned i = 0; i < count; i++) {
+        off_t block_offset = offset + (off_t)i * BLOCK_SIZE;
+        ssize_t moved = is_write
+                            ? pwrite(fd, ios[i].blk, BLOCK_SIZE, block_offset)
+                            : pread(fd, ios[i].blk, BLOCK_SIZE, block_offset);
+        if (moved != BLOCK_SIZE) ret = -1;
+    }
+    return ret;
+}
+
+// sends a byte range of the disk file to out_fd with sendfile, the mapping
+// and pwrite both go through the page cache that sendfile reads from
+uint64_t Disk::send_range(int out_fd, unsigned first, uint64_t length) {
+    if (first >= no_blocks ||
+        length > (uint64_t)(no_blocks - first) * BLOCK_SIZE)
+        return 0;
+    off_t offset = (off_t)first * BLOCK_SIZE;
+    uint64_t sent = 0;
+    while (sent < length) {
+        ssize_t done = sendfile(out_fd, fd, &offset, length - sent);
+        if (done <= 0) break;
+        sent += done;
+    }
+    count((sent + BLOCK_SIZE - 1) / BLOCK_SIZE, false);
+    return sent;
+}
+
+// makes every write since the last sync durable in the disk file
+int Disk::sync() {
+    // pwrite only handed the data to the kernel, the file still has to be
+    // flushed to the device
+    if (!map) return fdatasync(fd) ? -1 : 0;
+    size_t offset, length;
+    {
+        std::lock_guard<std::mutex> guard(dirty_lock);
+        if (dirty_lo > dirty_hi) return 0;
+        offset = (size_t)dirty_lo * BLOCK_SIZE;
+        length = (size_t)(dirty_hi - dirty_lo + 1) * BLOCK_SIZE;
+        dirty_lo = -1u;
+        dirty_hi = 0;
+    }
+    return msync(map + offset, length, MS_SYNC);
+}
+
+// counts blocks for the disk and for the operation the calling thread runs
+void Disk::count(uint64_t blocks, bool is_write) {
+    (is_write ? blocks_written : blocks_read) += blocks;
+    if (thread_stats) (is_write ? thread_stats->writes : thread_stats->reads) += blocks;
+}
+
+// widens the dirty range that the next sync has to cover
+void Disk::mark_dirty(unsigned lo, unsigned hi) {
+    std::lock_guard<std::mutex> guard(dirty_lock);
+    if (lo < dirty_lo) dirty_lo = lo;
+    if (hi > dirty_hi) dirty_hi = hi;
+}
@@ -1,30 +1,126 @@
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <stdint.h>
+#include <vector>
+
+#include "ioring.h"
 
 #ifndef __DISK_H__
 #define __DISK_H__
 
 #define DISKNAME "diskfile.bin"
 #define BLOCK_SIZE 4096
+// amount of blocks in a newly created disk file
+#define DEFAULT_NO_BLOCKS 2048
+// requests kept in flight by the io_uring backend
+#define DEFAULT_QUEUE_DEPTH 32
 #define DEBUG false
 
 class Disk {
+   public:
+    // how the disk file is accessed
+    enum Backend {
+        PREAD,  // one pread/pwrite system call per block
+        MMAP,   // the disk file is mapped into memory
+        URING   // batches of reads and writes are kept in flight with io_uring
+    };
+
+    // one block of a vectored read or write
+    struct BlockIO {
+        unsigned block_no;
+        uint8_t *blk;
+    };
+
+    // amounts of blocks moved to and from the disk file
+    struct Stats {
+        uint64_t reads;   // blocks read, sent blocks included
+        uint64_t writes;  // blocks written
+    };
+
    private:
-    std::fstream diskfile;
-    const unsigned no_blocks = 2048;
-    const unsigned disk_size = BLOCK_SIZE * no_blocks;
+    int fd;
+    uint8_t *map;
+    // first and last block written since the last sync, only used when mapped
+    unsigned dirty_lo;
+    unsigned dirty_hi;
+    // guards the dirty range, the journal writes and syncs from its own thread
+    std::mutex dirty_lock;
+    bool use_map;
+    // set up when the URING backend was asked for and io_uring is available
+    IoRing ring;
+    // counted by every backend, the blocks handed out by block() excepted
+    std::atomic<uint64_t> blocks_read;
+    std::atomic<uint64_t> blocks_written;
+    unsigned no_blocks;
+    uint64_t disk_size;
     bool disk_file_exists(const std::string &name);
+    // adds blocks to the read or write counters, and to thread_stats
+    void count(uint64_t blocks, bool is_write);
+    // widens the dirty range to cover the blocks lo to hi
+    void mark_dirty(unsigned lo, unsigned hi);
+    // maps the whole disk file if the MMAP backend was asked for, falling
+    // back to pread/pwrite if that fails
+    void map_disk();
+    // moves the blocks of one run of consecutive block numbers with a
+    // single preadv/pwritev, falling back to one block at a time
+    int transfer_run(const BlockIO *ios, unsigned count, bool is_write);
+    int transfer(std::vector<BlockIO> ios, bool is_write);
+    // moves every run of consecutive blocks with its own io_uring request,
+    // runs that fail are redone with transfer_run
+    int transfer_ring(const std::vector<BlockIO> &ios,
+                      const std::vector<unsigned> &runs, bool is_write,
+                      bool linked);
 
    public:
-    Disk();
+    Disk(Backend backend = MMAP, unsigned queue_depth = DEFAULT_QUEUE_DEPTH);
     ~Disk();
     unsigned get_no_blocks() { return no_blocks; }
-    unsigned get_disk_size() { return disk_size; }
+    uint64_t get_disk_size() { return disk_size; }
+    // grows or shrinks the disk file to no_blocks blocks, the contents of
+    // the blocks that are kept are unchanged
+    int resize(unsigned no_blocks);
+    bool is_mapped() const { return map != nullptr; }
+    // returns a pointer to a block inside the mapped disk file, or nullptr
+    // if the disk is not mapped or the block number is invalid
+    uint8_t *block(unsigned block_no);
     // writes one block to the disk
     int write(unsigned block_no, uint8_t *blk);
     // reads one block from the disk
     int read(unsigned block_no, uint8_t *blk);
+    // reads a list of blocks, blocks with consecutive numbers are read
+    // with a single system call
+    int readv(const std::vector<BlockIO> &ios);
+    // writes a list of blocks, blocks with consecutive numbers are written
+    // with a single system call
+    int writev(const std::vector<BlockIO> &ios);
+    // reads count consecutive blocks starting at first into blk
+    int read_range(unsigned first, unsigned count, uint8_t *blk);
+    // writes count consecutive blocks starting at first from blk
+    int write_range(unsigned first, unsigned count, uint8_t *blk);
+    // writes the groups one after the other, a group is only started once
+    // the one before it has been written, with io_uring as one chain of
+    // linked requests submitted at once
+    int write_ordered(const std::vector<std::vector<BlockIO>> &groups);
+    // counters of the io_uring backend, all zero for the other backends
+    const IoRing::Stats &get_ring_stats() const { return ring.stats(); }
+    // blocks read and written since the disk was opened or the counters
+    // were last reset
+    Stats get_stats() const { return Stats{blocks_read, blocks_written}; }
+    void reset_stats() {
+        blocks_read = 0;
+        blocks_written = 0;
+    }
+    // while set, the blocks the calling thread moves are also counted here,
+    // so an operation can tell what it cost
+    static thread_local Stats *thread_stats;
+    // sends length bytes starting at block first straight from the disk file
+    // to out_fd without copying them through user space, returns the amount
+    // of bytes sent which is less than length if sendfile fails
+    uint64_t send_range(int out_fd, unsigned first, uint64_t length);
+    // makes every write since the last sync durable in the disk file
+    int sync();
 };
 
 #endif  // __DISK_H__
@@ -0,0 +1,152 @@
+#include "fat.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Binds the FAT to a block cache and an allocator, nothing is mounted yet
+Fat::Fat(BlockCache* cache, Allocator* allocator)
+    : cache(cache),
+      allocator(allocator),
+      start(0),
+      entries(0),
+      perPage(0),
+      firstFree(0),
+      width(16),
+      loadedCount(0),
+      dirtyLo(-1u),
+      dirtyHi(0),
+      counters{},
+      nextUnloaded(0) {}
+
+// Drops every loaded FAT block and makes every block in use until its FAT block is loaded
+void Fat::mount(uint32_t start, uint32_t entries, int bits, uint32_t firstFree) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (bits != 16 && bits != 32) throw std::runtime_error("FAT entries must be 16 or 32 bits wide!");
+    this->start = start;
+    this->entries = entries;
+    this->width = bits;
+    this->perPage = BLOCK_SIZE / (bits / 8);
+    this->firstFree = firstFree;
+    this->pages.clear();
+    this->pages.resize((entries + this->perPage - 1) / this->perPage);
+    this->loadedCount = 0;
+    this->nextUnloaded = 0;
+    this->dirty.assign(this->pages.size(), false);
+    this->dirtyLo = -1u;
+    this->dirtyHi = 0;
+    this->allocator->reset(entries);
+}
+
+// Creates every FAT block in memory as free and dirty, which is what format() writes to the disk
+void Fat::clear() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->allocator->reset(this->entries);
+    for (size_t i = 0; i < this->pages.size(); i++) {
+        if (!this->pages[i]) this->pages[i].reset(new Page);
+        this->pages[i]->fill(0);
+        this->dirty[i] = true;
+    }
+    if (!this->pages.empty()) {
+        this->dirtyLo = 0;
+        this->dirtyHi = this->pages.size() - 1;
+    }
+    this->loadedCount = this->pages.size();
+    this->nextUnloaded = this->pages.size();
+
+    for (uint32_t i = 0; i < this->firstFree; i++) this->store(i, FAT_EOF);
+    for (uint32_t i = this->firstFree; i < this->entries; i++) this->allocator->release(i);
+}
+
+// Reads an entry
+int32_t Fat::get(uint32_t index) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->value(index);
+}
+
+// Changes an entry
+void Fat::set(uint32_t index, int32_t value) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->store(index, value);
+}
+
+// Reads an entry, 16-bit entries are sign extended so FAT_EOF reads the same at both widths
+int32_t Fat::value(uint32_t index) {
+    if (index >= this->entries) throw std::runtime_error("FAT index out of range!");
+    const uint8_t* data = this->page(index).data();
+    uint32_t offset = index % this->perPage;
+    if (this->width == 16) {
+        int16_t value;
+        std::memcpy(&value, data + offset * 2, 2);
+        return value;
+    }
+    int32_t value;
+    std::memcpy(&value, data + offset * 4, 4);
+    return value;
+}
+
+// Changes an entry in its loaded FAT block and marks the block dirty if the value is new
+void Fat::store(uint32_t index, int32_t value) {
+    if (this->value(index) == value) return;
+    uint32_t block = index / this->perPage;
+    uint8_t* data = this->pages[block]->data();
+    uint32_t offset = index % this->perPage;
+    if (this->width == 16) {
+        int16_t narrow = value;
+        std::memcpy(data + offset * 2, &narrow, 2);
+    } else {
+        std::memcpy(data + offset * 4, &value, 4);
+    }
+
+    this->counters.entryWrites++;
+    if (!this->dirty[block]) {
+        this->dirty[block] = true;
+        this->dirtyLo = std::min(this->dirtyLo, block);
+        this->dirtyHi = std::max(this->dirtyHi, block);
+    }
+}
+
+// Loads the lowest FAT block that is not loaded yet
+bool Fat::loadMore() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    while (this->nextUnloaded < this->pages.size() && this->pages[this->nextUnloaded]) this->nextUnloaded++;
+    if (this->nextUnloaded == this->pages.size()) return false;
+    this->load(this->nextUnloaded);
+    return true;
+}
+
+// Writes the dirty FAT blocks to the block cache, only the range between the lowest and highest one is scanned
+void Fat::flush() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->dirtyLo > this->dirtyHi) return;
+    for (uint32_t i = this->dirtyLo; i <= this->dirtyHi; i++) {
+        if (!this->dirty[i]) continue;
+        this->cache->write(this->start + i, this->pages[i]->data());
+        this->dirty[i] = false;
+        this->counters.blockWrites++;
+    }
+    this->counters.flushes++;
+    this->dirtyLo = -1u;
+    this->dirtyHi = 0;
+}
+
+// Returns the FAT block holding an entry, loading it on first access
+Fat::Page& Fat::page(uint32_t index) {
+    uint32_t block = index / this->perPage;
+    if (!this->pages[block]) this->load(block);
+    return *this->pages[block];
+}
+
+// Reads a FAT block through the block cache and hands its free entries to the allocator
+void Fat::load(uint32_t block) {
+    this->pages[block].reset(new Page);
+    if (this->cache->read(this->start + block, this->pages[block]->data()))
+        throw std::runtime_error("Failed to read a FAT block!");
+    this->loadedCount++;
+
+    uint32_t first = block * this->perPage;
+    uint32_t last = std::min<uint64_t>(uint64_t(first) + this->perPage, this->entries);
+    for (uint32_t i = std::max(first, this->firstFree); i < last; i++) {
+        if (this->value(i) == FAT_FREE) this->allocator->release(i);
+    }
+}
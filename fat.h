@@ -0,0 +1,130 @@
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "alloc.h"
+#include "cache.h"
+
+#ifndef __FAT_H__
+#define __FAT_H__
+
+#define FAT_FREE 0
+#define FAT_EOF -1
+
+/// @brief The file allocation table, one entry per disk block, stored in FAT_BLOCK or in as many blocks as the
+/// volume needs. FAT blocks are read the first time one of their entries is needed so a small part of a large
+/// volume costs as little as a small volume. Every call is atomic, chains are walked by many threads at once.
+class Fat {
+   public:
+    /// @brief Counters describing how much FAT data is written for the entries that change.
+    struct Stats {
+        uint64_t entryWrites;  // entries changed to a new value
+        uint64_t blockWrites;  // FAT blocks written to the block cache
+        uint64_t flushes;      // calls to flush() that wrote at least one FAT block
+    };
+
+    /// @brief Binds the FAT to the block cache it is stored through and the allocator it feeds.
+    /// @param cache The block cache.
+    /// @param allocator The allocator that learns about the free entries of every loaded FAT block.
+    Fat(BlockCache* cache, Allocator* allocator);
+
+    /// @brief Describes where the FAT is stored and drops every loaded FAT block.
+    /// @param start The first FAT block on the disk.
+    /// @param entries Amount of entries, which is the amount of blocks on the volume.
+    /// @param bits Width of an entry, 16 or 32.
+    /// @param firstFree Entries before this one belong to the root, superblock and FAT and are never free.
+    void mount(uint32_t start, uint32_t entries, int bits, uint32_t firstFree);
+
+    /// @brief Sets every entry to FAT_FREE without reading the FAT from the disk, the reserved entries become
+    /// FAT_EOF.
+    void clear();
+
+    /// @brief Reads an entry, loading its FAT block if needed.
+    /// @param index The entry.
+    /// @return The next block in the chain, FAT_EOF or FAT_FREE.
+    int32_t get(uint32_t index);
+
+    /// @brief Changes an entry, loading its FAT block if needed.
+    /// @param index The entry.
+    /// @param value The next block in the chain, FAT_EOF or FAT_FREE.
+    void set(uint32_t index, int32_t value);
+
+    /// @brief Loads the FAT block holding an entry so that the allocator knows about the free entries around it.
+    /// @param index The entry.
+    inline void touch(uint32_t index) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->page(index);
+    }
+
+    /// @brief Loads the first FAT block that is not loaded yet.
+    /// @return True if a block was loaded, false if the whole FAT is in memory.
+    bool loadMore();
+
+    /// @brief Writes the FAT blocks changed since the last flush to the block cache.
+    void flush();
+
+    /// @return Amount of entries.
+    inline uint32_t size() const { return this->entries; }
+
+    /// @return Width of an entry in bits.
+    inline int bits() const { return this->width; }
+
+    /// @return Amount of blocks the FAT is stored in.
+    inline uint32_t blocks() const { return this->pages.size(); }
+
+    /// @return Amount of FAT blocks that have been loaded.
+    inline uint32_t loadedBlocks() const { return this->loadedCount; }
+
+    /// @return The write counters.
+    inline const Stats& stats() const { return this->counters; }
+
+    /// @brief Sets every write counter to zero.
+    inline void resetStats() { this->counters = Stats{}; }
+
+   private:
+    typedef std::array<uint8_t, BLOCK_SIZE> Page;
+
+    /// @brief Returns the FAT block holding an entry, loading it if needed.
+    /// @param index The entry.
+    /// @return The FAT block.
+    Page& page(uint32_t index);
+
+    /// @brief Reads an entry, the caller holds the lock.
+    int32_t value(uint32_t index);
+
+    /// @brief Changes an entry, the caller holds the lock.
+    void store(uint32_t index, int32_t value);
+
+    /// @brief Reads a FAT block and releases its free entries to the allocator.
+    /// @param block Index of the FAT block, counted from the start of the FAT.
+    void load(uint32_t block);
+
+    BlockCache* cache;
+    Allocator* allocator;
+
+    uint32_t start;
+    uint32_t entries;
+    uint32_t perPage;
+    uint32_t firstFree;
+    int width;
+
+    // One slot per FAT block, empty until the block is loaded
+    std::vector<std::unique_ptr<Page>> pages;
+    uint32_t loadedCount;
+
+    // Set for the FAT blocks changed since the last flush, lowest and highest such block to keep flushes short
+    std::vector<bool> dirty;
+    uint32_t dirtyLo;
+    uint32_t dirtyHi;
+    Stats counters;
+
+    // No FAT block before this one is unloaded
+    uint32_t nextUnloaded;
+
+    // Guards everything above, taken before the locks of the block cache and the allocator
+    std::mutex lock;
+};
+
+#endif  // __FAT_H__
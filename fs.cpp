@@ -1,7 +1,12 @@
 #include "fs.h"
 
 #include <stdint.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <vector>
@@ -14,19 +19,173 @@ typedef std::array<char, BLOCK_SIZE> file_block;
 // usually shows how much of the last block is used
 static const int BLOCK_MASK = BLOCK_SIZE - 1;
 
+// Amount of blocks moved per vectored read or write when streaming file data
+static const size_t IO_BATCH_BLOCKS = 256;
+
+// Writes every byte to a file descriptor, retrying short writes
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t done = ::write(fd, data, length);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        data += done;
+        length -= done;
+    }
+    return true;
+}
+
+// Name a file is locked by, lookups only compare the first 56 characters of a name
+static inline std::string lockName(const std::string& name) { return name.substr(0, 56); }
+
+// Amount of files whose tails are cached for append
+static const size_t TAIL_CACHE_FILES = 64;
+
+// Distance between the blocks kept by a chain index, and amount of chains indexed at a time
+static const size_t CHAIN_SKIP = 64;
+static const size_t CHAIN_INDEX_FILES = 256;
+
+// Amount of share table entries stored in one block
+static const size_t SHARES_PER_BLOCK = BLOCK_SIZE / sizeof(share_entry);
+
+// Linear directories are turned into B-trees once they hold this many entries, "." and ".." included
+static const size_t DIR_TREE_ENTRIES = 4 * FS::DIR_BLK_SIZE;
+
+// Amount of records in a node of a B-tree directory, slot 0 holds the node header
+static const uint32_t TREE_NODE_SIZE = FS::DIR_BLK_SIZE - 1;
+
+// Reads the header of a B-tree node block
+static inline dir_tree_node nodeHeader(const dir_block& node) {
+    dir_tree_node header;
+    std::memcpy(&header, node.data(), sizeof(header));
+    return header;
+}
+
+// Writes the header of a B-tree node block
+static inline void setNodeHeader(dir_block& node, const dir_tree_node& header) {
+    std::memcpy(node.data(), &header, sizeof(header));
+}
+
+// Binary search in a B-tree node, returns the first record whose name isn't before name in a leaf, or the last key
+// whose name isn't after it in an inner node. Names are compared up to the 56 characters an entry holds.
+static int treeSlot(const dir_block& node, const dir_tree_node& header, const std::string& name) {
+    int low = 1;
+    int high = header.count + 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        int order = std::strncmp(node[middle].file_name, name.c_str(), sizeof(dir_entry::file_name));
+        if (header.leaf ? order < 0 : order <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return header.leaf ? low : low - 1;
+}
+
+// Amount of blocks needed to hold size bytes
+static inline size_t blocksFor(size_t size) { return (size + BLOCK_MASK) / BLOCK_SIZE; }
+
+// Volumes smaller than this have no metadata journal, larger ones get 1/32 of the volume within these bounds
+static const uint32_t JOURNAL_MIN_VOLUME = 256;
+static const uint32_t JOURNAL_MIN_BLOCKS = 64;
+static const uint32_t JOURNAL_MAX_BLOCKS = 8192;
+
+// Amount of journal blocks for a new volume of the given size
+static inline uint32_t journalBlocksFor(uint32_t blocks) {
+    if (blocks < JOURNAL_MIN_VOLUME) return 0;
+    return std::min(std::max(blocks / 32, JOURNAL_MIN_BLOCKS), JOURNAL_MAX_BLOCKS);
+}
+
 // -------------------FILE SYSTEM--------------------
 
-// Reads the FAT block and initilizes the working path
-FS::FS() : workingPath(&this->disk, this->fat) { this->readFat(); }
+// Mounts the volume on the disk and initilizes the working path
+FS::FS(Disk::Backend backend)
+    : activeOps(0),
+      commitDue(false),
+      dirFreesDue(false),
+      disk(backend),
+      journal(&this->disk),
+      cache(&this->disk),
+      fat(&this->cache, &this->allocator),
+      workingPath(this) {
+    // Group commits are preferred so that a steady stream of operations can't hold them off
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&this->opLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    this->mount();
+}
 
-// Default destructor
-FS::~FS() {}
+// Commits the journal and writes it home before the block cache writes back what is left
+FS::~FS() {
+    this->writeTails();
+    this->journal.close();
+    this->cache.setJournal(nullptr);
+    pthread_rwlock_destroy(&this->opLock);
+}
 
-// Formats the disk, i.e., creates an empty file system
+// Formats the disk, i.e., creates an empty file system that fills the whole disk
 int FS::format() {
-    this->fat[ROOT_BLOCK] = FAT_EOF;
-    this->fat[FAT_BLOCK] = FAT_EOF;
-    for (int i = 2; i < FS::FAT_SIZE; i++) this->fat[i] = FAT_FREE;
+    uint32_t blocks = this->disk.get_no_blocks();
+    return this->format(blocks, blocks <= MAX_FAT16_BLOCKS ? 16 : 32);
+}
+
+// Formats the disk with a superblock and a FAT with one fatBits wide entry per block, nothing else runs meanwhile
+int FS::format(uint32_t blocks, int fatBits) {
+    Operation op(this, OpStats::FORMAT, true);
+
+    // 16-bit entries can't point past MAX_FAT16_BLOCKS and FAT_EOF must not be a valid block
+    if (fatBits != 16 && fatBits != 32) return -1;
+    if (blocks > (fatBits == 16 ? MAX_FAT16_BLOCKS : MAX_FAT32_BLOCKS)) return -1;
+
+    // The root, the superblock, the FAT and the journal come first and at least one block must be left for data
+    uint32_t fatBlocks = (uint64_t(blocks) * (fatBits / 8) + BLOCK_MASK) / BLOCK_SIZE;
+    uint32_t journalBlocks = journalBlocksFor(blocks);
+    uint32_t firstFree = SUPER_BLOCK + 1 + fatBlocks + journalBlocks;
+    if (blocks <= firstFree) return -1;
+
+    // Whatever is cached or journaled belongs to the old volume, the new one is written without the journal
+    this->cache.flush();
+    this->journal.close();
+    this->cache.setJournal(nullptr);
+    this->cache.invalidate();
+    this->opFrees.clear();
+    this->groupFrees.clear();
+    this->dirFrees.clear();
+    if (this->disk.resize(blocks)) return -1;
+
+    superblock super{
+        .magic = SUPER_MAGIC,
+        .version = SUPER_VERSION,
+        .block_size = BLOCK_SIZE,
+        .no_blocks = blocks,
+        .fat_bits = uint32_t(fatBits),
+        .fat_start = SUPER_BLOCK + 1,
+        .fat_blocks = fatBlocks,
+        .journal_start = SUPER_BLOCK + 1 + fatBlocks,
+        .journal_blocks = journalBlocks,
+        .shares_start = 0,
+    };
+    file_block superBlock{};
+    std::memcpy(superBlock.data(), &super, sizeof(super));
+    this->write(SUPER_BLOCK, superBlock);
+
+    this->fat.mount(super.fat_start, blocks, fatBits, firstFree);
+    this->fat.clear();
+    this->wideEntries = fatBits == 32;
+    this->treeDirs = true;
+    this->tails.clear();
+    this->pendingTails.clear();
+    this->handles.clear();
+    this->chainIndexes.clear();
+    this->shares.clear();
+    this->shareSlots.clear();
+    this->sharesBlocks.clear();
+    this->sharesDirty.clear();
+    this->sharesStart = 0;
+    this->canShare = true;
+    this->dirIndexes.clear();
+    this->dentries.clear();
 
     // Size 64 to make sure we don't go out of scope in disk.write since that
     // the function takes a uint8_t* and then indexes 4096 steps into that
@@ -47,19 +206,33 @@ int FS::format() {
                              }};
 
     this->write(ROOT_BLOCK, directories);
-    this->writeFat();
-    this->workingPath = Path(&this->disk, this->fat);
+    {
+        std::lock_guard<std::mutex> guard(this->pathLock);
+        this->workingPath = Path(this);
+        for (auto& session : this->sessions)
+            if (session) *session = Path(this);
+    }
+    if (op.finish()) return -1;
+
+    // Operations on the new volume are journaled
+    if (journalBlocks && this->journal.create(super.journal_start, journalBlocks) == 0)
+        this->cache.setJournal(&this->journal);
     return 0;
 }
 
 // Creates a new file on the disk, the data content is
 // written on the following rows (ended with an empty row)
-int FS::create(std::string filepath) {
+int FS::create(std::string filepath) { return this->create(filepath, std::cin); }
+
+// Creates a new file with the rows read from input until an empty row, or with all of input, writing each batch of
+// blocks as soon as it is filled so that memory use doesn't grow with the file
+int FS::create(std::string filepath, std::istream& input, bool wholeStream) {
+    Operation op(this, OpStats::CREATE);
     dir_entry currentDir;
     std::string fileName;
 
     // Finds the directory where the file is supposed to be or return -1 if not found
-    if (!this->workingPath.findUpToLast(filepath, currentDir, fileName)) return -1;
+    if (!this->path().findUpToLast(filepath, currentDir, fileName)) return -1;
 
     // Validity check
     if (currentDir.type != TYPE_DIR) return -1;
@@ -67,83 +240,184 @@ int FS::create(std::string filepath) {
 
     // Creates new file entry
     dir_entry newFile{
+        .file_name = "",
+        .size = 0,
+        .first_blk = 0,
         .type = TYPE_FILE,
         .access_rights = READ | WRITE,
     };
 
-    // Making sure the file name is not too large
-    if (fileName.size() > 55) return -1;
+    // Sets file name by copying the last component in the path, making sure it is not too large
+    if (!this->setName(newFile, fileName)) return -1;
+
+    // Reads the rows a character at a time, every row ends with a newline even if the input ends without one, the
+    // whole stream is copied as it is a buffer at a time
+    std::streambuf* source = input.rdbuf();
+    std::vector<char> buffer(IO_BATCH_BLOCKS * BLOCK_SIZE);
+    size_t filled = 0;
+    uint64_t size = 0;
+    int32_t first = FAT_EOF;
+    int32_t last = FAT_EOF;
+    bool lineStart = true;
+    bool failed = false;
+    while (true) {
+        if (wholeStream) {
+            filled += source->sgetn(buffer.data() + filled, buffer.size() - filled);
+            if (filled < buffer.size()) break;
+        } else {
+            int c = source->sbumpc();
+            if (c == std::char_traits<char>::eof() || (c == '\n' && lineStart)) {
+                if (c != '\n' && !lineStart) buffer[filled++] = '\n';
+                break;
+            }
+            buffer[filled++] = c;
+            lineStart = c == '\n';
+        }
 
-    // Sets file name by copying the last component in the path
-    fileName.copy(newFile.file_name, 56);
+        // A full buffer is written right away, after a failure the rest of the rows are only read
+        if (filled == buffer.size()) {
+            if (!failed) failed = !this->extendChain(first, last, buffer.data(), IO_BATCH_BLOCKS, this->firstBlk(currentDir));
+            size += filled;
+            filled = 0;
+        }
+    }
+    size += filled;
 
-    // Gets file data from user
-    std::string data, line;
-    while (std::getline(std::cin, line) && !line.empty()) {
-        data += line + "\n";
+    // The last block is padded with zeros, a file always has at least one block
+    if (!failed && (filled > 0 || first == FAT_EOF)) {
+        size_t blocks = std::max<size_t>(1, blocksFor(filled));
+        std::fill(buffer.begin() + filled, buffer.begin() + blocks * BLOCK_SIZE, 0);
+        failed = !this->extendChain(first, last, buffer.data(), blocks, this->firstBlk(currentDir));
     }
 
-    // Creates new file in current directory with metadata and data
-    if (!this->__create(currentDir, newFile, data)) return -1;
+    // Adds the entry once the data is on the disk, sizes are stored in 32 bits
+    this->setFirstBlk(newFile, first);
+    newFile.size = size;
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(currentDir), "", true);
+    locks.lock();
+    if (failed || size > UINT32_MAX || !this->refreshDir(currentDir) || !(currentDir.access_rights & WRITE) ||
+        !this->addDirEntry(currentDir, newFile)) {
+        if (first != FAT_EOF) this->free(first);
+        return -1;
+    }
 
-    return 0;
+    return op.finish();
 }
 
 // Reads the content of a file and prints it on the screen
 int FS::cat(std::string filepath) {
+    // Whatever is buffered for stdout has to come out before the file
+    std::cout.flush();
+    fflush(stdout);
+    return this->cat(filepath, STDOUT_FILENO);
+}
+
+// Writes the content of a file to a file descriptor, sending runs of consecutive blocks straight from the disk file
+int FS::cat(std::string filepath, int fd) {
+    Operation op(this, OpStats::CAT);
+    dir_entry dir;
     dir_entry file;
-    if (!this->workingPath.find(filepath, file)) return -1;
+    std::string fileName;
+    if (!this->path().findUpToLast(filepath, dir, fileName)) return -1;
+
+    // The file can't change while it is sent, the directory may change once the entry is read
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(dir), "", false);
+    locks.add(this->firstBlk(dir), lockName(fileName), false);
+    locks.lock();
+    if (!this->refreshDir(dir) || !this->path().searchDir(dir, fileName, file)) return -1;
+    locks.unlock(this->firstBlk(dir), "");
     if (file.type != TYPE_FILE) return -1;
     if (!(file.access_rights & READ)) return -1;
 
-    int16_t nextFat = file.first_blk;
-    file_block dirBlock;
-    std::string print;
-
-    // Go through each full dirBlock
-    for (int i = 0; i < (file.size / BLOCK_SIZE); i++) {
-        if (nextFat == FAT_EOF) throw std::runtime_error(("1: Reached end of file before expected in cat()!"));
-
-        this->read(nextFat, dirBlock);
-        std::cout.write(dirBlock.data(), BLOCK_SIZE);
-        nextFat = this->fat[nextFat];
+    // The disk file must hold whatever batched appends gathered before it is sent
+    {
+        std::lock_guard<std::mutex> guard(this->tailLock);
+        auto found = this->tails.find(this->firstBlk(file));
+        if (found != this->tails.end()) this->writeTail(*found->second);
     }
 
-    // Go through the direntries in a non full dirblock
-    size_t rest = (file.size & BLOCK_MASK);
-    if (rest) {
-        if (nextFat == FAT_EOF) throw std::runtime_error("2: Reached end of file before expected in cat()!");
-
-        this->read(nextFat, dirBlock);
-        std::cout.write(dirBlock.data(), rest);
+    int32_t nextFat = this->firstBlk(file);
+    size_t left = file.size;
+    std::vector<int32_t> blocks;
+    std::vector<char> buffer;
+
+    // Goes through the file a batch of blocks at a time
+    while (left > 0) {
+        this->collectChain(nextFat, std::min(IO_BATCH_BLOCKS, blocksFor(left)), blocks);
+        if (blocks.empty()) throw std::runtime_error("Reached end of file before expected in cat()!");
+
+        // Every run of consecutive blocks is sent with sendfile, whatever it doesn't send is copied
+        size_t run = 0;
+        for (size_t i = 1; i <= blocks.size(); i++) {
+            if (i < blocks.size() && blocks[i] == blocks[i - 1] + 1) continue;
+            size_t length = std::min(left, (i - run) * BLOCK_SIZE);
+            size_t sent = this->cache.send(fd, blocks[run], i - run, length);
+            if (sent < length) {
+                std::vector<int32_t> rest(blocks.begin() + run + sent / BLOCK_SIZE, blocks.begin() + i);
+                buffer.resize(rest.size() * BLOCK_SIZE);
+                this->readv(rest, buffer.data());
+                if (!writeAll(fd, buffer.data() + sent % BLOCK_SIZE, length - sent)) return -1;
+            }
+            left -= length;
+            run = i;
+        }
     }
 
     return 0;
 }
 
 // ls() lists the content in the current directory (files and sub-directories)
-int FS::ls() {
-    if (!(this->workingPath.workingDir().access_rights & READ)) return -1;
+int FS::ls() { return this->ls(std::cout); }
+
+// Writes one row of the listing of a directory
+static void listEntry(std::ostream& out, const dir_entry& entry) {
+    std::string type = entry.type ? "dir" : "file";
+    std::string size = entry.type ? "-" : std::to_string(entry.size);
+    std::string rights;
+    rights += (entry.access_rights & READ) ? 'r' : '-';
+    rights += (entry.access_rights & WRITE) ? 'w' : '-';
+    rights += (entry.access_rights & EXECUTE) ? 'x' : '-';
+    out << std::string(entry.file_name) + "\t " + type + "\t " + rights + "\t\t " + size + "\n";
+}
+
+// Writes the listing of the current directory to out
+int FS::ls(std::ostream& out) {
+    Operation op(this, OpStats::LS);
+    dir_entry dir = this->path().workingDir();
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(dir), "", false);
+    locks.lock();
+    if (!this->refreshDir(dir)) return -1;
+    if (!(dir.access_rights & READ)) return -1;
 
-    int16_t nextFat = this->workingPath.workingDir().first_blk;
-    std::cout << "name\t type\t accessrights\t size\n";
+    out << "name\t type\t accessrights\t size\n";
+
+    // A B-tree is listed from its leftmost leaf along the leaves, which comes out sorted by name
+    BlockCache::View view;
+    const DirIndex& index = this->dirIndex(dir);
+    if (index.tree.root) {
+        int32_t leaf = index.tree.root;
+        for (uint32_t level = 1; level < index.tree.height; level++) leaf = this->viewDir(leaf, view)[1].size;
+        while (leaf) {
+            const dir_block& dirBlock = this->viewDir(leaf, view);
+            dir_tree_node header = nodeHeader(dirBlock);
+            for (uint32_t i = 1; i <= header.count; i++)
+                if (dirBlock[i].file_name[0] != '.') listEntry(out, dirBlock[i]);
+            leaf = header.next;
+        }
+        return 0;
+    }
 
+    int32_t nextFat = this->firstBlk(dir);
     while (nextFat != FAT_EOF) {
-        dir_block dirBlock{};
-        this->read(nextFat, dirBlock);
+        const dir_block& dirBlock = this->viewDir(nextFat, view);
         for (size_t i = 0; i < FS::DIR_BLK_SIZE; i++) {
             // Print if not hidden file
-            if (dirBlock[i].file_name[0] != '.' && isNotFreeEntry(dirBlock[i])) {
-                std::string type = dirBlock[i].type ? "dir" : "file";
-                std::string size = dirBlock[i].type ? "-" : std::to_string(dirBlock[i].size);
-                std::string rights;
-                rights += (dirBlock[i].access_rights & READ) ? 'r' : '-';
-                rights += (dirBlock[i].access_rights & WRITE) ? 'w' : '-';
-                rights += (dirBlock[i].access_rights & EXECUTE) ? 'x' : '-';
-                std::cout << std::string(dirBlock[i].file_name) + "\t " + type + "\t " + rights + "\t\t " + size + "\n";
-            }
+            if (dirBlock[i].file_name[0] != '.' && isNotFreeEntry(dirBlock[i])) listEntry(out, dirBlock[i]);
         }
-        nextFat = this->fat[nextFat];
+        nextFat = this->fat.get(nextFat);
     }
 
     return 0;
@@ -151,36 +425,68 @@ int FS::ls() {
 
 // Makes an exact copy of the file to a new file
 int FS::cp(std::string sourcepath, std::string destpath) {
+    Operation op(this, OpStats::CP);
+    dir_entry srcDir;
     dir_entry src;
     dir_entry dest;
 
     // Find src
-    if (!this->workingPath.find(sourcepath, src)) return -1;
+    std::string srcName;
+    if (!this->path().findUpToLast(sourcepath, srcDir, srcName)) return -1;
+    if (!this->path().lookup(srcDir, srcName, src)) return -1;
     if (src.type != TYPE_FILE) return -2;
     if (!(src.access_rights & READ)) return -2;
 
     // Find dest dir
     std::string fileName;
-    if (!this->workingPath.findUpToLast(destpath, dest, fileName)) return -3;
+    if (!this->path().findUpToLast(destpath, dest, fileName)) return -3;
     if (dest.type != TYPE_DIR) return -4;
 
     dir_entry filecpy = src;
 
     // Check if last is a dir or a new filename, if neither ERROR
-    if (!this->workingPath.searchDir(dest, fileName, dest)) {
-        for (int i = 0; i < 56; i++) filecpy.file_name[i] = 0;
-        fileName.copy(filecpy.file_name, 56);
+    if (!this->path().lookup(dest, fileName, dest)) {
+        if (!this->setName(filecpy, fileName)) return -5;
     } else {
         if (dest.type != TYPE_DIR) return -5;
     }
 
+    // The source can't change while it is copied, it is looked up again once it is locked
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(srcDir), "", false);
+    locks.add(this->firstBlk(srcDir), lockName(srcName), false);
+    locks.add(this->firstBlk(dest), "", true);
+    locks.lock();
+    if (!this->refreshDir(srcDir) || !this->path().searchDir(srcDir, srcName, src)) return -1;
+    if (src.type != TYPE_FILE) return -2;
+    if (!(src.access_rights & READ)) return -2;
+    if (!this->refreshDir(dest)) return -3;
+    std::string copyName = entryName(filecpy);
+    filecpy = src;
+    this->setName(filecpy, copyName);
+
     // Make sure we are allowed to write
     if (!(dest.access_rights & WRITE)) return -6;
 
+    // The copy shares the chain of the source, which is cloned once either file is written
+    int32_t first = this->firstBlk(src);
+    if (this->canShare) {
+        bool shared;
+        {
+            std::lock_guard<std::mutex> guard(this->sharesLock);
+            shared = this->growShares(this->shares.size() + !this->shares.count(first));
+            if (shared) {
+                if (!this->addDirEntry(dest, filecpy)) return -7;
+                this->addShare(first);
+            }
+        }
+        if (shared) return op.finish();
+    }
+
     // Reserve needed space
-    int16_t newFats = this->reserve(src.size);
+    int32_t newFats = this->reserve(src.size, this->firstBlk(dest));
     if (newFats == -1) return -1;
-    filecpy.first_blk = newFats;
+    this->setFirstBlk(filecpy, newFats);
 
     // Add entry
     if (!this->addDirEntry(dest, filecpy)) {
@@ -188,35 +494,23 @@ int FS::cp(std::string sourcepath, std::string destpath) {
         return -7;
     }
 
-    // Copy data
-    int16_t nextSrcFat = src.first_blk;
-    int16_t nextTargetFat = filecpy.first_blk;
-    while (nextSrcFat != FAT_EOF) {
-        file_block block{0};
-        this->read(nextSrcFat, block);
-        this->write(nextTargetFat, block);
-
-        nextSrcFat = this->fat[nextSrcFat];
-        nextTargetFat = this->fat[nextTargetFat];
-    }
-
-    // Writes updates to the FAT block
-    this->writeFat();
-
-    return 0;
+    this->copyChain(first, newFats);
+    return op.finish();
 }
 
 // Renames the file or moves the file to the directory (if dest is a directory)
 int FS::mv(std::string sourcepath, std::string destpath) {
+    Operation op(this, OpStats::MV);
     dir_entry srcDir;
     dir_entry srcFile;
 
     // Find src dir
     std::string fileName;
-    if (!this->workingPath.findUpToLast(sourcepath, srcDir, fileName)) return -1;
+    if (!this->path().findUpToLast(sourcepath, srcDir, fileName)) return -1;
+    std::string srcName = fileName;
 
     // Find src
-    if (!this->workingPath.searchDir(srcDir, fileName, srcFile)) return -2;
+    if (!this->path().lookup(srcDir, fileName, srcFile)) return -2;
 
     // Check that we are allowed to read and write
     if (!(srcDir.access_rights & WRITE)) return -1;
@@ -225,23 +519,41 @@ int FS::mv(std::string sourcepath, std::string destpath) {
     // Find possible target dir
     dir_entry fileCopy = srcFile;
     dir_entry targetDir;
-    if (!this->workingPath.findUpToLast(destpath, targetDir, fileName)) return -3;
+    if (!this->path().findUpToLast(destpath, targetDir, fileName)) return -3;
 
     // If the last entry is a valid directory, that entry is the target directory
     // If it is a file we cannot move here
     // If there exists no entry with the name fileName the name of our moved entry is changed to fileName
     dir_entry temp;
-    if (this->workingPath.searchDir(targetDir, fileName, temp)) {
+    if (this->path().lookup(targetDir, fileName, temp)) {
         if (temp.type == TYPE_DIR) {
             targetDir = temp;
         } else {
             return -4;
         }
-    } else {
-        fileName.copy(fileCopy.file_name, 56);
+    } else if (!this->setName(fileCopy, fileName)) {
+        return -4;
     }
 
+    // Both directories and the moved entry are locked, a moved directory too since its ".." entry changes
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(srcDir), "", true);
+    locks.add(this->firstBlk(srcDir), lockName(srcName), true);
+    locks.add(this->firstBlk(targetDir), "", true);
+    if (srcFile.type == TYPE_DIR) locks.add(this->firstBlk(srcFile), "", true);
+    locks.lock();
+
+    // The source is looked up again since it may have changed before it was locked
+    std::string copyName = entryName(fileCopy);
+    if (!this->refreshDir(srcDir) || !this->refreshDir(targetDir)) return -1;
+    if (!this->path().searchDir(srcDir, srcName, temp) || this->firstBlk(temp) != this->firstBlk(srcFile))
+        return -2;
+    srcFile = temp;
+    fileCopy = temp;
+    this->setName(fileCopy, copyName);
+
     // Validity check
+    if ((srcDir.access_rights & (READ | WRITE)) != (READ | WRITE)) return -1;
     if (!(targetDir.access_rights & WRITE)) return -1;
 
     // Moves the directory entry
@@ -252,57 +564,72 @@ int FS::mv(std::string sourcepath, std::string destpath) {
     // Updates the ".." file in directory
     if (fileCopy.type == TYPE_DIR) {
         dir_block dirBlock{};
-        this->read(fileCopy.first_blk, dirBlock);
+        this->read(this->firstBlk(fileCopy), dirBlock);
         dirBlock[1] = targetDir;
         std::string("..").copy(dirBlock[1].file_name, 56);
-        this->write(fileCopy.first_blk, dirBlock);
+        this->write(this->firstBlk(fileCopy), dirBlock);
+        this->dirChanged(this->firstBlk(fileCopy));
     }
 
-    // Writes updates to the FAT block
-    this->writeFat();
-    return 0;
+    return op.finish();
 }
 
 // Removes / deletes the file
 int FS::rm(std::string filepath) {
+    Operation op(this, OpStats::RM);
     dir_entry dir;
     dir_entry file;
 
     // Find source directory
     std::string fileName;
-    if (!this->workingPath.findUpToLast(filepath, dir, fileName)) return -1;
+    if (!this->path().findUpToLast(filepath, dir, fileName)) return -1;
 
     // Find source
-    if (!this->workingPath.searchDir(dir, fileName, file)) return -1;
+    if (!this->path().lookup(dir, fileName, file)) return -1;
+
+    // The entry is locked so that whoever reads or writes it finishes first, a directory as a whole so that nothing
+    // is added to it meanwhile
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(dir), "", true);
+    locks.add(this->firstBlk(dir), lockName(fileName), true);
+    if (file.type == TYPE_DIR) locks.add(this->firstBlk(file), "", true);
+    locks.lock();
+    int32_t first = this->firstBlk(file);
+    if (!this->refreshDir(dir) || !this->path().searchDir(dir, fileName, file) || int32_t(this->firstBlk(file)) != first)
+        return -1;
 
     // Make sure we have write rights
     if (!(dir.access_rights & WRITE)) return -1;
     if (!(dir.access_rights & READ)) return -1;
 
     // Removing ourselfs is not good
-    if(file.first_blk == this->workingPath.workingDir().first_blk) return -1;
+    if(this->firstBlk(file) == this->firstBlk(this->path().workingDir())) return -1;
 
     // If the entry is a directory, check that it is empty
     if (file.type == TYPE_DIR) {
-        dir_block dirblock;
-        this->read(file.first_blk, dirblock);
-        if (isNotFreeEntry(dirblock[2])) return -1;
+        if (!this->dirEmpty(file)) return -1;
     }
 
-    // Remove the entry and free the FAT
+    // Remove the entry and free the FAT unless a copy still uses it, directories are never shared
     if (!this->removeDirEntry(dir, file.file_name)) return -1;
-    this->free(file.first_blk);
+    if (file.type == TYPE_DIR)
+        this->free(first, true);
+    else
+        this->dropChain(first);
 
-    // Writes updates to the FAT block
-    this->writeFat();
-    return 0;
+    return op.finish();
 }
 
 // Appends the contents of file1 to the end of file2 without changing file1
 int FS::append(std::string filepath1, std::string filepath2) {
+    Operation op(this, OpStats::APPEND);
+
     // Find source
+    dir_entry srcDir;
     dir_entry src;
-    if (!this->workingPath.find(filepath1, src)) return -1;
+    std::string srcName;
+    if (!this->path().findUpToLast(filepath1, srcDir, srcName)) return -1;
+    if (!this->path().lookup(srcDir, srcName, src)) return -1;
     if (src.type != TYPE_FILE) return -2;
     if (src.size == 0) return 0;
 
@@ -310,14 +637,26 @@ int FS::append(std::string filepath1, std::string filepath2) {
     dir_entry dest;
     dir_entry destDir;
     int destBlockIndex;
-    int16_t destFatIndex;
+    int32_t destFatIndex;
     std::string targetFileName;
 
     // Finds the destination directory
-    if (!this->workingPath.findUpToLast(filepath2, destDir, targetFileName)) return -3;
+    if (!this->path().findUpToLast(filepath2, destDir, targetFileName)) return -3;
+
+    // Both files are locked and looked up again, the destination directory stays locked so the entry doesn't move
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(srcDir), "", false);
+    locks.add(this->firstBlk(srcDir), lockName(srcName), false);
+    locks.add(this->firstBlk(destDir), "", false);
+    locks.add(this->firstBlk(destDir), lockName(targetFileName), true);
+    locks.lock();
+    if (!this->refreshDir(srcDir) || !this->path().searchDir(srcDir, srcName, src)) return -1;
+    if (src.type != TYPE_FILE) return -2;
+    if (src.size == 0) return 0;
 
     // Finds the destination entry
-    if (!this->workingPath.searchDir(destDir, targetFileName, dest, destFatIndex, destBlockIndex)) return -4;
+    if (!this->refreshDir(destDir)) return -3;
+    if (!this->path().searchDir(destDir, targetFileName, dest, destFatIndex, destBlockIndex)) return -4;
 
     // Type check
     if (dest.type != TYPE_FILE) return -5;
@@ -326,121 +665,145 @@ int FS::append(std::string filepath1, std::string filepath2) {
     if (!(src.access_rights & READ)) return -6;
     if (!(dest.access_rights & WRITE)) return -7;
 
-    // Goes to the last block in the destination entry
-    int16_t destFat = dest.first_blk;
-    while (this->fat[destFat] != FAT_EOF) destFat = this->fat[destFat];
+    // A chain shared with copies of the file is cloned before it is written
+    if (!this->ownChain(dest, this->firstBlk(destDir), DirLocation{destFatIndex, destBlockIndex})) return -8;
+    int32_t ownFat = this->firstBlk(dest);
+
+    // The tail cache knows the last block in the destination entry and what it holds
+    std::shared_ptr<Tail> destTail = this->tail(ownFat, dest.size);
+    Tail& tail = *destTail;
+    int32_t destFat = tail.lastBlock;
 
     // Place to start adding new data in the last block of the destination entry
-    int offset = (int(dest.size) & BLOCK_MASK);
-
-    // Calculate neededSpace
-    int neededSpace;
-    if (dest.size == 0)
-        neededSpace = int(src.size) - BLOCK_SIZE;
-    else if (offset == 0)
-        neededSpace = int(src.size);
-    else
-        neededSpace = int(src.size) - BLOCK_SIZE + offset;
+    size_t offset = dest.size & BLOCK_MASK;
 
-    // Reserves necessary space
-    if (neededSpace > 0) {
-        int neededSpace = src.size - BLOCK_SIZE;
-        int16_t extraFatSpace = this->reserve(neededSpace);
+    // Reserves the blocks that the destination is missing, a file always has at least one block
+    size_t usedBlocks = std::max<size_t>(1, blocksFor(dest.size));
+    size_t neededBlocks = std::max<size_t>(1, blocksFor(size_t(dest.size) + src.size));
+    if (neededBlocks > usedBlocks) {
+        int32_t extraFatSpace = this->reserve((neededBlocks - usedBlocks) * BLOCK_SIZE, destFat);
         if (extraFatSpace == -1) return -8;
-        this->fat[destFat] = extraFatSpace;
-    }
-
-    // Incase the current FAT block is already full, go to next FAT block
-    if (dest.size > 0 && offset == 0 && neededSpace > 0) {
-        destFat = this->fat[destFat];
+        this->fat.set(destFat, extraFatSpace);
     }
 
-    int16_t srcFat = src.first_blk;
-    file_block srcData{};
-    file_block destData{};
-
-    // Copies data from file1 to the end of file2
-    this->read(destFat, destData);
-    while (srcFat != FAT_EOF) {
-        this->read(srcFat, srcData);
-
-        // Copies until the destination block is full
-        for (int i = 0; i < BLOCK_SIZE - offset; i++) {
-            destData[i + offset] = srcData[i];
+    // Writing starts in the last block unless it is already full
+    int32_t nextDestFat = (dest.size > 0 && offset == 0) ? this->fat.get(destFat) : destFat;
+
+    // Appending a file to itself reads everything before writing so that no source block is overwritten first
+    size_t batch = (this->firstBlk(src) == this->firstBlk(dest)) ? blocksFor(src.size) : IO_BATCH_BLOCKS;
+
+    // The buffer starts with the used part of the last destination block so the new data lines up with it
+    std::vector<char> buffer((batch + 1) * BLOCK_SIZE);
+    std::copy(tail.data.begin(), tail.data.begin() + offset, buffer.begin());
+
+    // Copies data from file1 to the end of file2 a batch of blocks at a time
+    int32_t srcFat = this->firstBlk(src);
+    size_t left = src.size;
+    size_t filled = offset;
+    std::vector<int32_t> srcBlocks;
+    std::vector<int32_t> destBlocks;
+    while (left > 0) {
+        this->collectChain(srcFat, std::min(batch, blocksFor(left)), srcBlocks);
+        if (srcBlocks.empty()) throw std::runtime_error("Reached end of file before expected in append()!");
+        this->readv(srcBlocks, buffer.data() + filled);
+
+        size_t length = std::min(left, srcBlocks.size() * BLOCK_SIZE);
+        left -= length;
+        filled += length;
+
+        // Only full blocks are written until the last batch, which is padded with zeros
+        size_t fullBlocks = left ? filled / BLOCK_SIZE : blocksFor(filled);
+        std::fill(buffer.begin() + filled, buffer.begin() + fullBlocks * BLOCK_SIZE, 0);
+        this->collectChain(nextDestFat, fullBlocks, destBlocks);
+
+        // The new last block goes to the tail cache, when appends are batched a partly filled one stays there
+        if (!left) {
+            bool keep = this->batchAppends && (filled & BLOCK_MASK);
+            auto last = buffer.begin() + (fullBlocks - 1) * BLOCK_SIZE;
+            std::copy(last, last + BLOCK_SIZE, tail.data.begin());
+            this->moveTail(tail, ownFat, destBlocks.back(), keep);
+            if (keep) destBlocks.pop_back();
         }
-        this->write(destFat, destData);
-
-        // Cleans the buffer
-        for (int i = 0; i < BLOCK_SIZE; i++) destData[i] = 0;
-
-        // Iterates to the next FAT block for the destination entry
-        destFat = this->fat[destFat];
+        if (!destBlocks.empty()) this->writev(destBlocks, buffer.data());
 
-        // Copies until the source block is empty
-        for (int i = 0; i < offset; i++) {
-            destData[i] = srcData[i - offset + BLOCK_SIZE];
+        // Moves what did not fill a block to the start of the buffer
+        if (left) {
+            std::copy(buffer.begin() + fullBlocks * BLOCK_SIZE, buffer.begin() + filled, buffer.begin());
+            filled -= fullBlocks * BLOCK_SIZE;
         }
-        srcFat = this->fat[srcFat];
     }
-    // Writes last data to the destination block
-    if (destFat != FAT_EOF) this->write(destFat, destData);
-
-    // Writes updates to the FAT block
-    this->writeFat();
 
     // Updates the dir_entry in the directory
-    dir_block dirBlock{};
-    this->read(destFatIndex, dirBlock);
-    dirBlock[destBlockIndex].size += src.size;
-    this->write(destFatIndex, dirBlock);
+    dest.size += src.size;
+    this->writeEntry(this->firstBlk(destDir), DirLocation{destFatIndex, destBlockIndex}, dest);
 
-    return 0;
+    return op.finish();
 }
 
 // Creates a new sub-directory in specified path
-int FS::mkdir(std::string dirpath) {
+int FS::mkdir(std::string dirpath) { return this->mkdir(dirpath, LINEAR); }
+
+// Creates the new sub-directories in the chosen format
+int FS::mkdir(std::string dirpath, DirFormat format) {
+    Operation op(this, OpStats::MKDIR);
+
     // Parses path
     std::vector<std::string> path;
     if (!Path::parsePath(dirpath, path)) return -1;
 
     // Finds the last valid dir_entry
-    dir_entry currentDir = this->workingPath.workingDir();
+    dir_entry currentDir = this->path().workingDir();
     auto it = path.begin();
     for (; it < path.end(); it++) {
         if (!(currentDir.access_rights & READ)) return -1;
-        if (!this->workingPath.searchDir(currentDir, *it, currentDir)) break;
+        if (!this->path().lookup(currentDir, *it, currentDir)) break;
     }
 
     // If the last valid dir_entry is a file or we have reached the end of the path we cannot create any directories
     if (it == path.end() || currentDir.type == TYPE_FILE || !(currentDir.access_rights & WRITE)) return -1;
 
-    // Creates directories from the rest of the path
+    // Creates directories from the rest of the path, each with only its parent locked
     for (; it < path.end(); it++) {
         dir_entry newDir{
+            .file_name = "",
+            .size = 0,
+            .first_blk = 0,
             .type = TYPE_DIR,
             .access_rights = READ | WRITE,
         };
-        it->copy(newDir.file_name, 56);
+        if (!this->setName(newDir, *it)) return -1;
+        LockTable::Set locks(&this->locks);
+        locks.add(this->firstBlk(currentDir), "", true);
+        locks.lock();
+        if (!this->refreshDir(currentDir) || !(currentDir.access_rights & WRITE)) return -1;
         if (!this->__create(currentDir, newDir, "")) return -1;
+        if (format == BTREE && this->treeDirs && !this->makeTree(newDir, this->dirIndex(newDir))) return -1;
         currentDir = newDir;
     }
-    return 0;
+    return op.finish();
 }
 
 // Changes the current working directory to the specified path
 int FS::cd(std::string dirpath) {
-    if (!this->workingPath.cd(dirpath)) return -1;
+    Operation op(this, OpStats::CD);
+    if (!this->path().cd(dirpath)) return -1;
     return 0;
 }
 
 // Prints the full path, i.e., from the root directory to the current directory, including the current directory name
-int FS::pwd() {
-    std::cout << this->workingPath.pwd() + "\n";
+int FS::pwd() { return this->pwd(std::cout); }
+
+// Writes the full path of the current directory to out
+int FS::pwd(std::ostream& out) {
+    Operation op(this, OpStats::PWD);
+    out << this->path().pwd() + "\n";
     return 0;
 }
 
 // Changes the access rights for the file to the specified access rights
 int FS::chmod(std::string accessrights, std::string filepath) {
+    Operation op(this, OpStats::CHMOD);
+
     // Parses the access rights
     if (accessrights.size() > 1) return -1;
     if (!std::isdigit(accessrights[0])) return -1;
@@ -449,42 +812,417 @@ int FS::chmod(std::string accessrights, std::string filepath) {
     // Finds the directory that the target lies in
     dir_entry dir;
     std::string fileName;
-    if (!this->workingPath.findUpToLast(filepath, dir, fileName)) return -1;
-
-    // Finds the target
+    if (!this->path().findUpToLast(filepath, dir, fileName)) return -1;
     dir_entry target;
-    int16_t fatIndex;
-    int blockIndex;
-    if (!this->workingPath.searchDir(dir, fileName, target, fatIndex, blockIndex)) return -1;
+    if (!this->path().lookup(dir, fileName, target)) return -1;
+
+    // Only the entry changes in place, so the directory is locked shared and the target exclusively. A target
+    // directory is locked as a whole too since its "." entry changes.
+    LockTable::Set locks(&this->locks);
+    locks.add(this->firstBlk(dir), "", false);
+    locks.add(this->firstBlk(dir), lockName(fileName), true);
+    if (target.type == TYPE_DIR) locks.add(this->firstBlk(target), "", true);
+    locks.lock();
+    if (!this->refreshDir(dir)) return -1;
+
+    // Finds the target again, it must still be the one that was locked
+    int32_t first = this->firstBlk(target);
+    uint8_t type = target.type;
+    DirLocation location;
+    if (!this->path().searchDir(dir, fileName, target, location.fatIndex, location.blockIndex) ||
+        int32_t(this->firstBlk(target)) != first || target.type != type)
+        return -1;
 
     // Not allowed to chmod root
-    if (target.first_blk == ROOT_BLOCK) return -1;
+    if (this->firstBlk(target) == ROOT_BLOCK) return -1;
 
     // Updates dir_entry in the directory
-    dir_block dirBlock{};
-    this->read(fatIndex, dirBlock);
-    dirBlock[blockIndex].access_rights = accessRightBin;
-    this->write(fatIndex, dirBlock);
+    target.access_rights = accessRightBin;
+    this->writeEntry(this->firstBlk(dir), location, target);
 
     // Updates the "." entry in directory
     if (target.type == TYPE_DIR) {
-        this->read(target.first_blk, dirBlock);
-        dirBlock[0].access_rights = accessRightBin;
-        this->write(target.first_blk, dirBlock);
+        this->cache.write(this->firstBlk(target), offsetof(dir_entry, access_rights), sizeof(uint8_t),
+                          &accessRightBin);
+        this->dirChanged(this->firstBlk(target));
     }
 
     // Updates the entry in the current path with the new data provided
-    this->workingPath.updatePathEntry(target, target);
+    {
+        std::lock_guard<std::mutex> guard(this->pathLock);
+        this->workingPath.updatePathEntry(target, target);
+        for (auto& session : this->sessions)
+            if (session) session->updatePathEntry(target, target);
+    }
+
+    return op.finish();
+}
+
+// Writes every modified block held in the block cache back to the disk, or commits it to the journal once the
+// operation ends whether the group is due or not
+int FS::sync() {
+    Operation op(this, OpStats::SYNC);
+    int ret = op.finish();
+    if (this->journal.enabled()) this->commitDue = true;
+    return ret;
+}
 
+// Prints a row per kind of operation that ran, latencies are the upper bounds of histogram buckets
+int FS::stats(std::ostream& out) {
+    char row[160];
+    std::snprintf(row, sizeof(row), "%-9s %9s %10s %9s %9s %10s %10s %14s\n", "op", "calls", "avg(us)", "p50(us)",
+                  "p99(us)", "reads/op", "writes/op", "dirblks/lookup");
+    out << row;
+    for (int i = 0; i < OpStats::OP_COUNT; i++) {
+        OpStats::Counters counters = this->ops.get(OpStats::Op(i));
+        if (!counters.calls) continue;
+        double calls = counters.calls;
+        std::snprintf(row, sizeof(row), "%-9s %9llu %10.1f %9llu %9llu %10.2f %10.2f %14.2f\n",
+                      OpStats::name(OpStats::Op(i)), (unsigned long long)counters.calls, counters.micros / calls,
+                      (unsigned long long)OpStats::percentile(counters, 0.50),
+                      (unsigned long long)OpStats::percentile(counters, 0.99), counters.blockReads / calls,
+                      counters.blockWrites / calls,
+                      counters.lookups ? double(counters.dirBlocksScanned) / counters.lookups : 0.0);
+        out << row;
+    }
+
+    Disk::Stats disk = this->disk.get_stats();
+    const BlockCache::Stats& cache = this->cache.stats();
+    const DentryCache::Stats& dentries = this->dentries.stats();
+    const Fat::Stats& fat = this->fat.stats();
+    const Journal::Stats& journal = this->journal.stats();
+    out << "disk: " << disk.reads << " blocks read, " << disk.writes << " blocks written\n";
+    out << "block cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+        << " evictions, " << cache.writebacks << " writebacks\n";
+    out << "dentry cache: " << dentries.hits << " hits, " << dentries.misses << " misses, " << dentries.invalidations
+        << " invalidations\n";
+    out << "fat: " << fat.entryWrites << " entries changed, " << fat.blockWrites << " blocks written back in "
+        << fat.flushes << " flushes\n";
+    out << "journal: " << journal.commits << " commits, " << journal.blocksLogged << " blocks logged, "
+        << journal.checkpoints << " checkpoints\n";
+    return 0;
+}
+
+// Resets the counters while no operation runs, so that none of them is half counted
+void FS::resetStats() {
+    pthread_rwlock_wrlock(&this->opLock);
+    this->ops.reset();
+    this->disk.reset_stats();
+    this->cache.resetStats();
+    this->dentries.resetStats();
+    this->fat.resetStats();
+    this->journal.resetStats();
+    pthread_rwlock_unlock(&this->opLock);
+}
+
+// Writes the changed FAT blocks and every modified block held in the block cache back to the disk, or to the
+// journal, this is the only place the FAT is written so an operation writes each FAT block it changed once
+int FS::endOperation() {
+    {
+        std::lock_guard<std::mutex> guard(this->sharesLock);
+        this->writeShares();
+    }
+    this->writeFat();
+    int ret = this->cache.flush();
+    if (!this->journal.enabled()) return ret;
+
+    // The blocks freed by the operation may be reused once the group it is part of is committed, which needs every
+    // other operation out of the way, so it is left to the end of the operation
+    {
+        std::lock_guard<std::mutex> guard(this->allocLock);
+        this->groupFrees.insert(this->groupFrees.end(), this->opFrees.begin(), this->opFrees.end());
+        this->opFrees.clear();
+    }
+    if (this->journal.endOperation()) this->commitDue = true;
+    return ret;
+}
+
+// Commits the journal and gives the blocks freed by the group back to the allocator, the caller holds opLock
+// exclusively
+void FS::commitGroup() {
+    this->journal.commit();
+    this->releaseDirFrees();
+    std::lock_guard<std::mutex> guard(this->allocLock);
+    this->releaseFrees();
+}
+
+// Checks that a directory still exists and rereads its entry from its "." entry
+bool FS::refreshDir(dir_entry& dir) {
+    int32_t first = this->firstBlk(dir);
+    if (first == ROOT_BLOCK) return true;
+    if (this->fat.get(first) == FAT_FREE) return false;
+    dir_entry self = this->readEntry(first, 0);
+    if (!this->isNotFreeEntry(self) || self.type != TYPE_DIR || int32_t(this->firstBlk(self)) != first) return false;
+    dir.access_rights = self.access_rights;
+    return true;
+}
+
+// Waits for a commit of the journal to finish and counts the operation as running
+FS::Operation::Operation(FS* fs, OpStats::Op kind, bool exclusive)
+    : fs(fs),
+      kind(kind),
+      exclusive(exclusive),
+      finished(false),
+      start(std::chrono::steady_clock::now()),
+      activity() {
+    int ret = exclusive ? pthread_rwlock_wrlock(&fs->opLock) : pthread_rwlock_rdlock(&fs->opLock);
+    if (ret) throw std::runtime_error("Failed to start an operation!");
+    OpStats::current = &this->activity;
+    Disk::thread_stats = &this->activity.io;
+    fs->activeOps++;
+}
+
+// Counts the operation once it has ended, with whatever its commit cost. An operation that failed half way may have
+// changed blocks already, which are written like those of a finished one instead of being left to a later operation,
+// the operations that only read have nothing to write.
+FS::Operation::~Operation() {
+    switch (this->kind) {
+        case OpStats::CAT:
+        case OpStats::LS:
+        case OpStats::CD:
+        case OpStats::PWD:
+        case OpStats::OPEN:
+        case OpStats::PREAD:
+            break;
+        default:
+            if (!this->finished) this->fs->endOperation();
+    }
+    this->end();
+    OpStats::current = nullptr;
+    Disk::thread_stats = nullptr;
+    auto elapsed = std::chrono::steady_clock::now() - this->start;
+    this->fs->ops.record(this->kind, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+                         this->activity);
+}
+
+// Writes what the operation changed, the destructor then only ends it
+int FS::Operation::finish() {
+    this->finished = true;
+    return this->fs->endOperation();
+}
+
+// Counts the operation as done and commits the group if the operation ended it, or gives back the blocks of the
+// directories it removed, once no other operation runs
+void FS::Operation::end() {
+    this->fs->activeOps--;
+    bool commit = this->fs->commitDue.exchange(false);
+    bool dirFrees = this->fs->dirFreesDue.exchange(false);
+    if (!this->exclusive) {
+        pthread_rwlock_unlock(&this->fs->opLock);
+        if (!commit && !dirFrees) return;
+        pthread_rwlock_wrlock(&this->fs->opLock);
+    }
+    if (commit)
+        this->fs->commitGroup();
+    else if (dirFrees)
+        this->fs->releaseDirFrees();
+    pthread_rwlock_unlock(&this->fs->opLock);
+}
+
+// Opens a file for random access, the access rights of the file must allow the mode
+int FS::open(std::string filepath, int mode) {
+    Operation op(this, OpStats::OPEN);
+    dir_entry dir;
+    dir_entry file;
+    std::string fileName;
+    if (mode & ~(READ | WRITE) || !mode) return -1;
+    if (!this->path().findUpToLast(filepath, dir, fileName)) return -1;
+    if (!this->path().lookup(dir, fileName, file)) return -1;
+    if (file.type != TYPE_FILE) return -1;
+    if ((file.access_rights & mode) != mode) return -1;
+
+    // Reuses the first closed slot
+    Handle handle{int32_t(this->firstBlk(dir)), entryName(file), mode};
+    std::lock_guard<std::mutex> guard(this->handleLock);
+    for (size_t i = 0; i < this->handles.size(); i++) {
+        if (this->handles[i].dirBlock != -1) continue;
+        this->handles[i] = handle;
+        return i;
+    }
+    this->handles.push_back(handle);
+    return this->handles.size() - 1;
+}
+
+// Reads a range of an open file, only the blocks holding the range are read
+int64_t FS::pread(int handle, char* data, size_t length, uint64_t offset) {
+    Operation op(this, OpStats::PREAD);
+    Handle open;
+    if (!this->getHandle(handle, READ, open)) return -1;
+
+    // The file can't change while it is read, the directory may change once the entry is read
+    LockTable::Set locks(&this->locks);
+    locks.add(open.dirBlock, "", false);
+    locks.add(open.dirBlock, open.name, false);
+    locks.lock();
+    dir_entry file;
+    DirLocation location;
+    if (!this->findHandle(open, file, location)) return -1;
+    locks.unlock(open.dirBlock, "");
+    if (offset >= file.size) return 0;
+    length = std::min<uint64_t>(length, file.size - offset);
+
+    // Starts at the block holding offset and copies the requested part of every batch of blocks
+    size_t index = offset / BLOCK_SIZE;
+    size_t end = blocksFor(offset + length);
+    int32_t nextFat = this->seekChain(this->firstBlk(file), index);
+    std::vector<int32_t> blocks;
+    std::vector<char> buffer;
+    size_t done = 0;
+    while (done < length) {
+        this->collectChain(nextFat, std::min(IO_BATCH_BLOCKS, end - index), blocks);
+        if (blocks.empty()) throw std::runtime_error("Reached end of file before expected in pread()!");
+        buffer.resize(blocks.size() * BLOCK_SIZE);
+        this->readv(blocks, buffer.data());
+
+        size_t skip = (offset + done) - index * BLOCK_SIZE;
+        size_t count = std::min(length - done, buffer.size() - skip);
+        std::copy(buffer.begin() + skip, buffer.begin() + skip + count, data + done);
+        done += count;
+        index += blocks.size();
+    }
+    return length;
+}
+
+// Writes a range of an open file, a shared chain is cloned first and a file written past its end grows
+int64_t FS::pwrite(int handle, const char* data, size_t length, uint64_t offset) {
+    Operation op(this, OpStats::PWRITE);
+    Handle open;
+    if (!this->getHandle(handle, WRITE, open)) return -1;
+
+    // The entry is written in place, which only needs the directory shared
+    LockTable::Set locks(&this->locks);
+    locks.add(open.dirBlock, "", false);
+    locks.add(open.dirBlock, open.name, true);
+    locks.lock();
+    dir_entry file;
+    DirLocation location;
+    if (!this->findHandle(open, file, location)) return -1;
+    if (length == 0) return 0;
+
+    // Sizes are stored in 32 bits
+    uint64_t end = std::max<uint64_t>(file.size, offset + length);
+    if (end > UINT32_MAX) return -1;
+
+    int32_t dirBlock = open.dirBlock;
+    if (!this->ownChain(file, dirBlock, location)) return -1;
+    if (!this->writeRange(file, data, offset, length)) return -1;
+    if (end != file.size) {
+        file.size = end;
+        this->writeEntry(dirBlock, location, file);
+    }
+    if (op.finish()) return -1;
+    return length;
+}
+
+// Changes the size of an open file, the blocks past the new end are freed and the rest of the last block is zeroed
+int FS::truncate(int handle, uint64_t size) {
+    Operation op(this, OpStats::TRUNCATE);
+    Handle open;
+    if (!this->getHandle(handle, WRITE, open)) return -1;
+
+    // The entry is written in place, which only needs the directory shared
+    LockTable::Set locks(&this->locks);
+    locks.add(open.dirBlock, "", false);
+    locks.add(open.dirBlock, open.name, true);
+    locks.lock();
+    dir_entry file;
+    DirLocation location;
+    if (!this->findHandle(open, file, location)) return -1;
+    if (size > UINT32_MAX) return -1;
+    if (size == file.size) return 0;
+
+    int32_t dirBlock = open.dirBlock;
+    if (!this->ownChain(file, dirBlock, location)) return -1;
+
+    // Growing is a write of nothing at the new end
+    if (size > file.size) {
+        if (!this->writeRange(file, nullptr, size, 0)) return -1;
+    } else {
+        // Cuts the chain after the new last block, a file always has at least one block
+        int32_t first = this->firstBlk(file);
+        std::shared_ptr<Tail> lastTail = this->tail(first, file.size);
+        Tail& tail = *lastTail;
+        {
+            std::lock_guard<std::mutex> guard(this->tailLock);
+            this->writeTail(tail);
+        }
+        size_t keep = std::max<size_t>(1, blocksFor(size));
+        int32_t last = this->seekChain(first, keep - 1);
+        int32_t rest = this->fat.get(last);
+        if (rest != FAT_EOF) {
+            this->fat.set(last, FAT_EOF);
+            this->free(rest);
+            this->trimChainIndex(first, keep);
+        }
+
+        // Bytes past the end of a file are zero so that growing it again reads zeros
+        file_block lastBlock{};
+        this->read(last, lastBlock);
+        std::fill(lastBlock.begin() + (size & BLOCK_MASK), lastBlock.end(), 0);
+        this->writev(std::vector<int32_t>{last}, lastBlock.data());
+        this->moveTail(tail, first, last, false);
+        tail.data = lastBlock;
+    }
+
+    file.size = size;
+    this->writeEntry(dirBlock, location, file);
+    return op.finish();
+}
+
+// Closes a handle so its slot can be reused
+int FS::close(int handle) {
+    std::lock_guard<std::mutex> guard(this->handleLock);
+    if (handle < 0 || size_t(handle) >= this->handles.size() || this->handles[handle].dirBlock == -1) return -1;
+    this->handles[handle].dirBlock = -1;
+    return 0;
+}
+
+// Starts a session whose working directory is the root, reusing the first closed slot
+int FS::openSession() {
+    std::lock_guard<std::mutex> guard(this->pathLock);
+    for (size_t i = 0; i < this->sessions.size(); i++) {
+        if (this->sessions[i]) continue;
+        this->sessions[i].reset(new Path(this));
+        return i;
+    }
+    this->sessions.emplace_back(new Path(this));
+    return this->sessions.size() - 1;
+}
+
+// Binds the calling thread to a session, or back to the shared working directory
+int FS::useSession(int session) {
+    std::lock_guard<std::mutex> guard(this->pathLock);
+    if (session == -1) {
+        FS::sessionFs = nullptr;
+        FS::sessionPath = nullptr;
+        return 0;
+    }
+    if (session < 0 || size_t(session) >= this->sessions.size() || !this->sessions[session]) return -1;
+    FS::sessionFs = this;
+    FS::sessionPath = this->sessions[session].get();
+    return 0;
+}
+
+// Ends a session so its slot can be reused
+int FS::closeSession(int session) {
+    std::lock_guard<std::mutex> guard(this->pathLock);
+    if (session < 0 || size_t(session) >= this->sessions.size() || !this->sessions[session]) return -1;
+    if (FS::sessionPath == this->sessions[session].get()) {
+        FS::sessionFs = nullptr;
+        FS::sessionPath = nullptr;
+    }
+    this->sessions[session].reset();
     return 0;
 }
 
 // ----------------PATH HELPER CLASS-----------------
 
 // Constructor for the FS::Path class
-FS::Path::Path(Disk* disk, int16_t* const fat) : disk(disk), fat(fat) {
+FS::Path::Path(FS* fs) : fs(fs) {
     // Initializes the root directory entry
     dir_entry root{
+        .file_name = "",
+        .size = 0,
         .first_blk = 0,
         .type = TYPE_DIR,
         .access_rights = READ | WRITE,
@@ -496,26 +1234,50 @@ FS::Path::Path(Disk* disk, int16_t* const fat) : disk(disk), fat(fat) {
 
 // Finds the directory entry for the given to the last component
 bool FS::Path::find(const std::string& path, dir_entry& result) const {
-    std::vector<std::string> pathv;
-
-    // Parses the given path into components
-    if (!this->parsePath(path, pathv)) return false;
-
-    // Starts from the working directory
-    result = this->workingDir();
-
-    // Traverses each component in the parsed path while checking if it's a directory,
-    // and searches for the next component in the current directory
-    for (std::string file : pathv) {
-        if (!result.type == TYPE_DIR) return false;
-        if (!this->searchDir(result, file, result)) return false;
+    // Answers from the dentry cache if the path has been resolved before
+    std::string key = this->dentryKey('=', path);
+    DentryCache::Dentry dentry{};
+    uint64_t generation;
+    if (this->fs->dentries.lookup(key, dentry, generation)) {
+        if (dentry.found) result = dentry.entry;
+        return dentry.found;
     }
-    return true;
+
+    std::vector<int32_t> dirs;
+    dentry.found = this->walk(path, false, dentry.entry, dentry.last, dirs);
+    this->fs->dentries.insert(key, dentry, dirs, generation);
+    if (dentry.found) result = dentry.entry;
+    return dentry.found;
 }
 
 // Finds the directory entry for the given path up to before the last component
 // The variable last becomes the last component of the path
 bool FS::Path::findUpToLast(const std::string& path, dir_entry& result, std::string& last) const {
+    // Answers from the dentry cache if the path has been resolved before
+    std::string key = this->dentryKey('<', path);
+    DentryCache::Dentry dentry{};
+    uint64_t generation;
+    if (this->fs->dentries.lookup(key, dentry, generation)) {
+        if (dentry.found) {
+            result = dentry.entry;
+            last = dentry.last;
+        }
+        return dentry.found;
+    }
+
+    std::vector<int32_t> dirs;
+    dentry.found = this->walk(path, true, dentry.entry, dentry.last, dirs);
+    this->fs->dentries.insert(key, dentry, dirs, generation);
+    if (dentry.found) {
+        result = dentry.entry;
+        last = dentry.last;
+    }
+    return dentry.found;
+}
+
+// Resolves a path from the working directory, all the way or up to before the last component
+bool FS::Path::walk(const std::string& path, bool upToLast, dir_entry& result, std::string& last,
+                    std::vector<int32_t>& dirs) const {
     std::vector<std::string> pathv;
 
     // Parses the given path into components
@@ -524,25 +1286,34 @@ bool FS::Path::findUpToLast(const std::string& path, dir_entry& result, std::str
     // Starts from the working directory
     result = this->workingDir();
 
-    // Traverses each component in the parsed path up to the last while checking if it's a directory,
+    // Traverses each component in the parsed path while checking if it's a directory,
     // and searches for the next component in the current directory
-    for (auto it = pathv.begin(); it < pathv.end() - 1; it++) {
-        if (!result.type == TYPE_DIR) return false;
-        if (!this->searchDir(result, *it, result)) return false;
+    auto end = upToLast ? pathv.end() - 1 : pathv.end();
+    for (auto it = pathv.begin(); it < end; it++) {
+        if (result.type != TYPE_DIR) return false;
+        dirs.push_back(this->fs->firstBlk(result));
+        if (!this->lookup(result, *it, result)) return false;
     }
-    last = pathv.back();
+    if (upToLast) last = pathv.back();
     return true;
 }
 
+// Makes a dentry cache key that doesn't depend on the working directory
+std::string FS::Path::dentryKey(char kind, const std::string& path) const {
+    // Relative paths are keyed by the block of the working directory since its name may be outdated
+    if (!path.empty() && path[0] == '/') return kind + path;
+    return kind + std::to_string(this->fs->firstBlk(this->workingDir())) + ":" + path;
+}
+
 // Wrapper for searchDir() that doesn't require the fatIndex and blockIndex return parameters
 inline bool FS::Path::searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result) const {
-    int16_t fatIndex;
+    int32_t fatIndex;
     int blockIndex;
     return this->searchDir(dir, fileName, result, fatIndex, blockIndex);
 }
 
 // Searches for a specified file in the directory and returns the FAT block's index and the index where result exists
-bool FS::Path::searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result, int16_t& fatIndex,
+bool FS::Path::searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result, int32_t& fatIndex,
                          int& blockIndex) const {
     // Checks if the file is an absolute path
     if (fileName == "/") {
@@ -550,43 +1321,47 @@ bool FS::Path::searchDir(const dir_entry& dir, const std::string& fileName, dir_
         return true;
     }
 
-    // Creates container for a directory block
-    dir_block dirBlock{};
-
     // Validity check
+    if (dir.type != TYPE_DIR) return false;
     if (!(dir.access_rights & READ)) return false;
 
-    // Goes through each block in the directory
-    fatIndex = dir.first_blk;
-    while (fatIndex != FAT_EOF) {
-        this->disk->read(fatIndex, (uint8_t*)dirBlock.data());
-
-        // Goes through each directory entry in the block
-        for (blockIndex = 0; blockIndex < FS::DIR_BLK_SIZE; blockIndex++) {
-            // Checks if we are at the end of the directory
-            if (!isNotFreeEntry(dirBlock[blockIndex])) return false;
+    // Looks the name up in the index of the directory, which is built on first access
+    if (OpStats::current) OpStats::current->lookups++;
+    DirLocation location;
+    if (!this->fs->findEntry(dir, fileName.substr(0, 56), location)) return false;
 
-            // Checks if the entry has been found
-            if (fileName.compare(0, 56, dirBlock[blockIndex].file_name) == 0) {
-                result = dirBlock[blockIndex];
-                return true;
-            }
-        }
-        fatIndex = this->fat[fatIndex];
-    }
+    fatIndex = location.fatIndex;
+    blockIndex = location.blockIndex;
+    result = this->fs->readEntry(fatIndex, blockIndex);
+    return true;
+}
 
-    return false;
+// Searches a directory while holding its lock shared, the root can't be removed so "/" needs no lock
+bool FS::Path::lookup(const dir_entry& dir, const std::string& fileName, dir_entry& result) const {
+    if (fileName == "/") return this->searchDir(dir, fileName, result);
+    LockTable::Set locks(&this->fs->locks);
+    locks.add(this->fs->firstBlk(dir), "", false);
+    locks.lock();
+
+    // A directory removed after it was found has no entries, its index would be built from whatever its block leads to
+    dir_entry current = dir;
+    if (!this->fs->refreshDir(current)) return false;
+    return this->searchDir(dir, fileName, result);
 }
 
 // Adds path to current path
 bool FS::Path::cd(const std::string& path) {
-    // Makes copy of working path
-    std::vector<dir_entry> newPath(this->path);
+    // Makes copy of working path, which is only changed by the thread running cd
+    std::vector<dir_entry> newPath;
+    {
+        std::lock_guard<std::mutex> guard(this->fs->pathLock);
+        newPath = this->path;
+    }
 
     // Parses path
     std::vector<std::string> pathv;
     if (!this->parsePath(path, pathv)) return false;
-    dir_entry dir = this->workingDir();
+    dir_entry dir = newPath.back();
 
     // Checks for absolute path
     auto it = pathv.begin();
@@ -610,7 +1385,7 @@ bool FS::Path::cd(const std::string& path) {
             if (!(dir.access_rights & READ)) return false;
 
             // Searches for the directory and adds it to the newPath
-            if (this->searchDir(dir, *it, dir)) {
+            if (this->lookup(dir, *it, dir)) {
                 if (dir.type != TYPE_DIR) return false;
                 newPath.emplace_back(dir);
             } else {
@@ -620,12 +1395,20 @@ bool FS::Path::cd(const std::string& path) {
     }
 
     // Applies the newPath
+    std::lock_guard<std::mutex> guard(this->fs->pathLock);
     this->path = newPath;
     return true;
 }
 
+// Returns a copy of the working directory entry, which cd may replace at any time
+dir_entry FS::Path::workingDir() const {
+    std::lock_guard<std::mutex> guard(this->fs->pathLock);
+    return this->path.back();
+}
+
 // Formats the working path to a string
 std::string FS::Path::pwd() const {
+    std::lock_guard<std::mutex> guard(this->fs->pathLock);
     std::string path = "/";
 
     // Skips root in the iterator
@@ -676,75 +1459,450 @@ bool FS::Path::parsePath(const std::string& paths, std::vector<std::string>& pat
     return true;
 }
 
-// Finds entry in path and changes it to new data
+// Finds entry in path and changes it to new data, the caller holds pathLock
 void FS::Path::updatePathEntry(const dir_entry& entry, dir_entry newData) {
     // Finds correct entry and changes it
     for (dir_entry& dir : this->path) {
-        if (dir.first_blk == entry.first_blk) {
+        if (this->fs->firstBlk(dir) == this->fs->firstBlk(entry)) {
             dir = newData;
             return;
         }
     }
 }
 
+// Checks whether the path goes through a directory, the caller holds pathLock
+bool FS::Path::contains(int32_t first) const {
+    for (const dir_entry& dir : this->path)
+        if (int32_t(this->fs->firstBlk(dir)) == first) return true;
+    return false;
+}
+
 // -----------------HELPER FUNCTIONS-----------------
 
-// Wrapper for disk.read() to make read operations safer and less verbose
-inline void FS::read(const int16_t block, dir_block& dirBlock) { this->disk.read(block, (uint8_t*)dirBlock.data()); }
+thread_local const FS* FS::sessionFs = nullptr;
+thread_local FS::Path* FS::sessionPath = nullptr;
+
+// The session path is only used by the file system it was opened on
+FS::Path& FS::path() { return FS::sessionFs == this ? *FS::sessionPath : this->workingPath; }
+
+// Wrapper for cache.read() to make read operations safer and less verbose, every directory block read is counted
+inline void FS::read(const int32_t block, dir_block& dirBlock) {
+    if (OpStats::current) OpStats::current->dirBlocksScanned++;
+    this->cache.read(block, (uint8_t*)dirBlock.data());
+}
+
+// Wrapper for cache.read() to make read operations safer and less verbose
+inline void FS::read(const int32_t block, std::array<char, BLOCK_SIZE>& fileBlock) {
+    this->cache.read(block, (uint8_t*)fileBlock.data());
+}
+
+// Reads one entry through the block cache, an entry that can't be read looks like a free entry
+inline dir_entry FS::readEntry(const int32_t block, int index) {
+    dir_entry entry{};
+    if (this->cache.read(block, index * sizeof(dir_entry), sizeof(dir_entry), (uint8_t*)&entry)) return dir_entry{};
+    return entry;
+}
+
+// Wrapper for cache.view(), blocks that can't be read look like empty blocks just like a failed read, every directory
+// block looked at is counted
+inline const dir_block& FS::viewDir(const int32_t block, BlockCache::View& view) {
+    static const dir_block emptyBlock{};
+    if (OpStats::current) OpStats::current->dirBlocksScanned++;
+    view = this->cache.view(block);
+    return view ? *(const dir_block*)view->data() : emptyBlock;
+}
 
-// Wrapper for disk.read() to make read operations safer and less verbose
-inline void FS::read(const int16_t block, std::array<char, BLOCK_SIZE>& fileBlock) {
-    this->disk.read(block, (uint8_t*)fileBlock.data());
+// Wrapper for cache.view(), blocks that can't be read look like empty blocks just like a failed read
+inline const char* FS::viewFile(const int32_t block, BlockCache::View& view) {
+    static const file_block emptyBlock{};
+    view = this->cache.view(block);
+    return view ? (const char*)view->data() : emptyBlock.data();
+}
+
+// Wrapper for cache.readv() that reads every block into one buffer, in the same order as blocks
+void FS::readv(const std::vector<int32_t>& blocks, char* data) {
+    std::vector<Disk::BlockIO> ios(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) ios[i] = Disk::BlockIO{unsigned(blocks[i]), (uint8_t*)data + i * BLOCK_SIZE};
+    this->cache.readv(ios);
+
+    // Last blocks gathered by batched appends are newer than the disk
+    std::lock_guard<std::mutex> guard(this->tailLock);
+    if (this->pendingTails.empty()) return;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        auto found = this->pendingTails.find(blocks[i]);
+        if (found == this->pendingTails.end()) continue;
+        const Tail& tail = *this->tails.at(found->second);
+        std::copy(tail.data.begin(), tail.data.end(), data + i * BLOCK_SIZE);
+    }
 }
 
-// Wrapper for disk.read() for reading fat to memory
-inline void FS::readFat() { this->disk.read(FAT_BLOCK, (uint8_t*)this->fat); }
+// Wrapper for cache.writev() that writes every block from one buffer, in the same order as blocks
+void FS::writev(const std::vector<int32_t>& blocks, const char* data) {
+    std::vector<Disk::BlockIO> ios(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) ios[i] = Disk::BlockIO{unsigned(blocks[i]), (uint8_t*)data + i * BLOCK_SIZE};
+    this->cache.writev(ios);
+}
 
-// Wrapper for disk.write() to make write operations safer and less verbose
-inline void FS::write(const int16_t block, const dir_block& dirBlock) {
-    this->disk.write(block, (uint8_t*)dirBlock.data());
+// Wrapper for cache.write() to make write operations safer and less verbose
+inline void FS::write(const int32_t block, const dir_block& dirBlock) {
+    this->cache.write(block, (uint8_t*)dirBlock.data());
 }
 
-// Wrapper for disk.write() to make write operations safer and less verbose
-inline void FS::write(const int16_t block, const std::array<char, BLOCK_SIZE>& fileBlock) {
-    this->disk.write(block, (uint8_t*)fileBlock.data());
+// Wrapper for cache.write() to make write operations safer and less verbose
+inline void FS::write(const int32_t block, const std::array<char, BLOCK_SIZE>& fileBlock) {
+    this->cache.write(block, (uint8_t*)fileBlock.data());
 }
 
-// Wrapper for disk.write() for writing fat to memory
-inline void FS::writeFat() { this->disk.write(FAT_BLOCK, (uint8_t*)this->fat); }
+// Wrapper for fat.flush() for writing the changed FAT blocks to the block cache
+inline void FS::writeFat() { this->fat.flush(); }
 
 // Returns whether dir entry is free or not by checking if file_name starts with NULL terminator
 inline bool FS::isNotFreeEntry(const dir_entry& dir) { return dir.file_name[0] != 0; }
 
-// Returns index of FAT_FREE slot or -1 if there is none
-int FS::getEmptyFat() const {
-    for (uint16_t i = 2; i < FS::FAT_SIZE; i++)
-        if (this->fat[i] == FAT_FREE) return i;
-    return -1;
+// Drops the cached paths that were resolved through a directory whose entries changed
+inline void FS::dirChanged(int32_t dirBlock) { this->dentries.invalidate(dirBlock); }
+
+// Returns the name index of a directory, building it from the directory blocks on first access
+FS::DirIndex& FS::dirIndex(const dir_entry& dir) {
+    {
+        std::lock_guard<std::mutex> guard(this->dirIndexLock);
+        auto found = this->dirIndexes.find(this->firstBlk(dir));
+        if (found != this->dirIndexes.end()) return found->second;
+    }
+
+    // Entries are kept dense, so the directory ends at the first free entry. The lock of the directory keeps it from
+    // changing meanwhile, but two readers may build it at once and the first one to finish wins
+    DirIndex index;
+    index.tree = dir_tree_header{};
+    int32_t fatIndex = this->firstBlk(dir);
+    BlockCache::View view;
+    while (fatIndex != FAT_EOF) {
+        const dir_block& dirBlock = this->viewDir(fatIndex, view);
+
+        // A B-tree keeps its header after "." and ".." and is searched on disk, only the header is indexed
+        if (fatIndex == int32_t(this->firstBlk(dir))) {
+            dir_tree_header header;
+            std::memcpy(&header, &dirBlock[2], sizeof(header));
+            if (header.zero == 0 && header.magic == DIR_TREE_MAGIC) {
+                index.tree = header;
+                index.lastBlock = header.last;
+                index.lastCount = 0;
+                break;
+            }
+        }
+
+        index.lastBlock = fatIndex;
+        index.lastCount = 0;
+        while (index.lastCount < FS::DIR_BLK_SIZE && isNotFreeEntry(dirBlock[index.lastCount])) {
+            index.entries[entryName(dirBlock[index.lastCount])] = DirLocation{fatIndex, index.lastCount};
+            index.lastCount++;
+        }
+        fatIndex = this->fat.get(fatIndex);
+    }
+    std::lock_guard<std::mutex> guard(this->dirIndexLock);
+    return this->dirIndexes.emplace(this->firstBlk(dir), std::move(index)).first->second;
+}
+
+// Reads the superblock, volumes without one have a single 16-bit FAT in FAT_BLOCK
+void FS::mount() {
+    file_block superBlock{};
+    this->read(SUPER_BLOCK, superBlock);
+    superblock super;
+    std::memcpy(&super, superBlock.data(), sizeof(super));
+
+    if (super.magic != SUPER_MAGIC) {
+        this->fat.mount(FAT_BLOCK, BLOCK_SIZE / 2, 16, FAT_BLOCK + 1);
+        this->wideEntries = false;
+        this->treeDirs = false;
+        this->canShare = false;
+        return;
+    }
+
+    // The block size is fixed when the file system is built so other volumes can't be mounted
+    if (super.version > SUPER_VERSION || super.block_size != BLOCK_SIZE ||
+        super.no_blocks > this->disk.get_no_blocks()) {
+        std::cerr << "ERROR: Unsupported volume in " << DISKNAME << " (version " << super.version << ", block size "
+                  << super.block_size << ", " << super.no_blocks << " blocks), exiting..." << std::endl;
+        exit(-1);
+    }
+    // Transactions committed before a crash are written home before anything else is read, the superblock is read
+    // again since a replayed transaction may have changed it
+    if (super.journal_blocks) {
+        if (this->journal.open(super.journal_start, super.journal_blocks) == -1)
+            std::cout << "WARNING: Can't open the journal, metadata is written without it\n";
+        else
+            this->cache.setJournal(&this->journal);
+        this->cache.invalidate();
+        this->read(SUPER_BLOCK, superBlock);
+        std::memcpy(&super, superBlock.data(), sizeof(super));
+    }
+
+    uint32_t firstFree = std::max(super.fat_start + super.fat_blocks, super.journal_start + super.journal_blocks);
+    this->fat.mount(super.fat_start, super.no_blocks, super.fat_bits, firstFree);
+    this->wideEntries = super.fat_bits == 32;
+    this->treeDirs = super.version >= 3;
+    this->canShare = true;
+    this->sharesStart = super.version >= 2 ? super.shares_start : 0;
+    this->loadShares();
+}
+
+// Reads the share table, every block holds entries up to the first one with no references
+void FS::loadShares() {
+    this->shares.clear();
+    this->shareSlots.clear();
+    this->sharesBlocks.clear();
+    this->sharesDirty.clear();
+    if (this->sharesStart == 0) return;
+
+    int32_t block = this->sharesStart;
+    while (block != FAT_EOF) {
+        BlockCache::View view;
+        const share_entry* table = (const share_entry*)this->viewFile(block, view);
+        for (size_t i = 0; i < SHARES_PER_BLOCK && table[i].refs; i++) {
+            this->shares[table[i].first_blk] = Share{table[i].refs, uint32_t(this->shareSlots.size())};
+            this->shareSlots.push_back(table[i].first_blk);
+        }
+        this->sharesBlocks.push_back(block);
+        block = this->fat.get(block);
+    }
+    this->sharesDirty.assign(this->sharesBlocks.size(), false);
+}
+
+// Grows the chain of the share table, the superblock learns where the table is the first time a chain is shared
+bool FS::growShares(size_t count) {
+    uint32_t needed = std::max<size_t>(1, (count + SHARES_PER_BLOCK - 1) / SHARES_PER_BLOCK);
+    if (this->sharesBlocks.size() >= needed) return true;
+
+    if (this->sharesStart == 0) {
+        int32_t start = this->reserve(needed * BLOCK_SIZE, SUPER_BLOCK);
+        if (start == -1) return false;
+
+        file_block superBlock{};
+        this->read(SUPER_BLOCK, superBlock);
+        superblock super;
+        std::memcpy(&super, superBlock.data(), sizeof(super));
+        super.version = SUPER_VERSION;
+        super.shares_start = start;
+        std::memcpy(superBlock.data(), &super, sizeof(super));
+        this->write(SUPER_BLOCK, superBlock);
+
+        this->sharesStart = start;
+        this->collectChain(start, needed, this->sharesBlocks);
+        this->sharesDirty.assign(needed, true);
+        return true;
+    }
+
+    // Links more blocks after the last block of the table, they are written empty
+    int32_t more = this->reserve((needed - this->sharesBlocks.size()) * BLOCK_SIZE, this->sharesBlocks.back());
+    if (more == -1) return false;
+    this->fat.set(this->sharesBlocks.back(), more);
+    while (more != FAT_EOF) {
+        this->sharesBlocks.push_back(more);
+        more = this->fat.get(more);
+    }
+    this->sharesDirty.resize(needed, true);
+    return true;
+}
+
+// Writes the blocks of the share table holding a changed slot, slots past the last entry are written empty
+void FS::writeShares() {
+    for (size_t b = 0; b < this->sharesDirty.size(); b++) {
+        if (!this->sharesDirty[b]) continue;
+        std::array<share_entry, SHARES_PER_BLOCK> table{};
+        for (size_t i = 0; i < SHARES_PER_BLOCK && b * SHARES_PER_BLOCK + i < this->shareSlots.size(); i++) {
+            int32_t first = this->shareSlots[b * SHARES_PER_BLOCK + i];
+            table[i] = share_entry{uint32_t(first), this->shares[first].refs};
+        }
+        this->cache.write(this->sharesBlocks[b], (const uint8_t*)table.data());
+        this->sharesDirty[b] = false;
+    }
+}
+
+// Counts a file more sharing a chain, a chain shared for the first time takes the slot after the last entry
+void FS::addShare(int32_t first) {
+    auto found = this->shares.find(first);
+    if (found == this->shares.end()) {
+        found = this->shares.emplace(first, Share{0, uint32_t(this->shareSlots.size())}).first;
+        this->shareSlots.push_back(first);
+    }
+    found->second.refs++;
+    this->sharesDirty[found->second.slot / SHARES_PER_BLOCK] = true;
+}
+
+// Counts a file less sharing a chain, the last entry moves to the slot of an entry with no references left so the
+// table stays packed
+void FS::dropShare(std::unordered_map<int32_t, Share>::iterator found) {
+    uint32_t slot = found->second.slot;
+    this->sharesDirty[slot / SHARES_PER_BLOCK] = true;
+    if (--found->second.refs) return;
+
+    int32_t last = this->shareSlots.back();
+    this->shareSlots[slot] = last;
+    this->shares[last].slot = slot;
+    this->sharesDirty[(this->shareSlots.size() - 1) / SHARES_PER_BLOCK] = true;
+    this->shareSlots.pop_back();
+    this->shares.erase(found);
+}
+
+// Returns the name of an entry, which is not NULL terminated if it is 56 characters long
+inline std::string FS::entryName(const dir_entry& entry) {
+    return std::string(entry.file_name, strnlen(entry.file_name, sizeof(entry.file_name)));
+}
+
+// Reads the first block of an entry, the upper 16 bits are stored after the name when entries are wide
+inline uint32_t FS::firstBlk(const dir_entry& entry) const {
+    uint32_t block = entry.first_blk;
+    if (this->wideEntries) {
+        block |= uint32_t(uint8_t(entry.file_name[WIDE_NAME_SIZE])) << 16;
+        block |= uint32_t(uint8_t(entry.file_name[WIDE_NAME_SIZE + 1])) << 24;
+    }
+    return block;
+}
+
+// Sets the first block of an entry, the upper 16 bits are stored after the name when entries are wide
+inline void FS::setFirstBlk(dir_entry& entry, uint32_t block) const {
+    entry.first_blk = block;
+    if (this->wideEntries) {
+        entry.file_name[WIDE_NAME_SIZE] = block >> 16;
+        entry.file_name[WIDE_NAME_SIZE + 1] = block >> 24;
+    }
+}
+
+// Names on wide volumes end two bytes early to make room for the upper half of first_blk
+inline size_t FS::maxNameLength() const { return (this->wideEntries ? WIDE_NAME_SIZE : sizeof(dir_entry::file_name)) - 1; }
+
+// Clears the old name and copies the new one, leaving the first block as it was
+bool FS::setName(dir_entry& entry, const std::string& name) const {
+    if (name.size() > this->maxNameLength()) return false;
+    std::fill(entry.file_name, entry.file_name + this->maxNameLength() + 1, 0);
+    name.copy(entry.file_name, name.size());
+    return true;
+}
+
+// Takes a FAT_FREE slot and marks it as FAT_EOF, returns -1 if there is none, the caller holds allocLock
+int32_t FS::allocFat(int32_t hint) {
+    // Only loaded FAT blocks are known to the allocator, so more are loaded until a free entry turns up
+    if (this->allocPolicy == FS::CONTIGUOUS) this->fat.touch(hint);
+    int32_t index;
+    do {
+        index = this->allocPolicy == FS::CONTIGUOUS ? this->allocator.allocateNear(hint) : this->allocator.allocate();
+    } while (index == -1 && (this->fat.loadMore() || this->commitFrees()));
+    if (index == -1) return -1;
+    this->fat.set(index, FAT_EOF);
+    return index;
+}
+
+// Sets a FAT entry to FAT_FREE and gives it back to the allocator, on a journaled volume only once the change is
+// committed since the old contents are still needed if the change is lost in a crash, the caller holds allocLock
+inline void FS::releaseFat(int32_t index) {
+    this->fat.set(index, FAT_FREE);
+    if (this->journal.enabled())
+        this->opFrees.push_back(index);
+    else
+        this->allocator.release(index);
+}
+
+// Gives the blocks freed by committed operations back to the allocator, the caller holds allocLock
+void FS::releaseFrees() {
+    for (int32_t index : this->groupFrees) this->allocator.release(index);
+    this->groupFrees.clear();
+}
+
+// Any operation that found a removed directory before it was removed has ended once none runs, later ones can only
+// reach it through a working path, which may stay in it for as long as it likes. The caller holds opLock exclusively.
+void FS::releaseDirFrees() {
+    std::vector<int32_t> blocks;
+    {
+        std::lock_guard<std::mutex> guard(this->allocLock);
+        blocks.swap(this->dirFrees);
+    }
+    for (int32_t block : blocks) {
+        bool used;
+        {
+            std::lock_guard<std::mutex> guard(this->pathLock);
+            used = this->workingPath.contains(block);
+            for (auto& session : this->sessions) used = used || (session && session->contains(block));
+        }
+
+        if (used) {
+            std::lock_guard<std::mutex> guard(this->allocLock);
+            this->dirFrees.push_back(block);
+            continue;
+        }
+
+        // Nor may an index or a path found through a session that was still in the directory outlive the block, on
+        // a journaled volume the block waits for the next commit like any other
+        {
+            std::lock_guard<std::mutex> guard(this->dirIndexLock);
+            this->dirIndexes.erase(block);
+        }
+        this->dirChanged(block);
+        std::lock_guard<std::mutex> guard(this->allocLock);
+        if (this->journal.enabled())
+            this->groupFrees.push_back(block);
+        else
+            this->allocator.release(block);
+    }
+}
+
+// Commits the journal early so the blocks freed by earlier operations can be reused, which can't be done while
+// another operation is half done
+bool FS::commitFrees() {
+    if (this->groupFrees.empty() || this->activeOps > 1 || this->journal.commit()) return false;
+    this->releaseFrees();
+    return true;
 }
 
 // Reserves enough FAT blocks to fit size bytes
-int16_t FS::reserve(size_t size) {
-    // Calculates amount of needed nodes and sets the first node as occupied in the FAT table
-    int neededNodes = (size + (BLOCK_SIZE - 1)) / BLOCK_SIZE;
-    int16_t firstNode = this->getEmptyFat();
-    if (firstNode == -1) return false;
-    this->fat[firstNode] = FAT_EOF;
+int32_t FS::reserve(size_t size, int32_t hint) {
+    std::lock_guard<std::mutex> guard(this->allocLock);
+
+    // Calculates amount of needed nodes, at least one node is always reserved
+    size_t neededNodes = (size + (BLOCK_SIZE - 1)) / BLOCK_SIZE;
+    if (neededNodes == 0) neededNodes = 1;
+
+    // Links the fewest possible extents, preferably a single run close to hint
+    if (this->allocPolicy == FS::CONTIGUOUS) {
+        // The FAT block around hint is loaded first, then more until the loaded blocks have room enough
+        this->fat.touch(hint);
+        while (this->allocator.freeBlocks() < neededNodes && (this->fat.loadMore() || this->commitFrees())) continue;
+
+        std::vector<Allocator::Extent> extents;
+        if (!this->allocator.allocateExtents(neededNodes, hint, extents)) return -1;
+
+        int32_t firstNode = extents.front().start;
+        int32_t prevNode = -1;
+        for (const Allocator::Extent& extent : extents) {
+            for (uint32_t i = extent.start; i < extent.start + extent.length; i++) {
+                if (prevNode != -1) this->fat.set(prevNode, i);
+                prevNode = i;
+            }
+        }
+        this->fat.set(prevNode, FAT_EOF);
+        return firstNode;
+    }
+
+    // Sets the first node as occupied in the FAT table
+    int32_t firstNode = this->allocFat(hint);
+    if (firstNode == -1) return -1;
 
     // Sets up FAT linked list
-    int16_t prevNode = firstNode;
-    for (int i = 0; i < (neededNodes - 1); i++) {
-        int16_t newNode = this->getEmptyFat();
+    int32_t prevNode = firstNode;
+    for (size_t i = 0; i < (neededNodes - 1); i++) {
+        int32_t newNode = this->allocFat(prevNode);
 
         // Links previous node to new node
         if (newNode != -1) {
-            this->fat[prevNode] = newNode;
-            this->fat[newNode] = FAT_EOF;
+            this->fat.set(prevNode, newNode);
             prevNode = newNode;
 
             // Breaks the connection if there is no space for the new node
         } else {
-            free(firstNode);
+            for (int32_t node = firstNode; node != FAT_EOF;) {
+                int32_t next = this->fat.get(node);
+                this->releaseFat(node);
+                node = next;
+            }
             return -1;
         }
     }
@@ -752,13 +1910,325 @@ int16_t FS::reserve(size_t size) {
     return firstNode;
 }
 
+// Reserves count blocks after the last block of a chain, or close to hint for a new chain, and writes data to them
+bool FS::extendChain(int32_t& first, int32_t& last, const char* data, size_t count, int32_t hint) {
+    int32_t start = this->reserve(count * BLOCK_SIZE, last == FAT_EOF ? hint : last);
+    if (start == -1) return false;
+    if (last == FAT_EOF)
+        first = start;
+    else
+        this->fat.set(last, start);
+
+    // Writes the new blocks and finds the new end of the chain
+    int32_t fatIndex = start;
+    std::vector<int32_t> blocks;
+    this->collectChain(fatIndex, count, blocks);
+    this->writev(blocks, data);
+    last = blocks.back();
+    return true;
+}
+
+// Collects up to count blocks of a FAT chain and moves fatIndex past them
+void FS::collectChain(int32_t& fatIndex, size_t count, std::vector<int32_t>& blocks) {
+    blocks.clear();
+    while (fatIndex != FAT_EOF && blocks.size() < count) {
+        blocks.push_back(fatIndex);
+        fatIndex = this->fat.get(fatIndex);
+    }
+}
+
+// Copies the data of a chain a batch of blocks at a time
+void FS::copyChain(int32_t src, int32_t dest) {
+    std::vector<int32_t> srcBlocks;
+    std::vector<int32_t> destBlocks;
+    std::vector<char> buffer;
+    while (src != FAT_EOF) {
+        this->collectChain(src, IO_BATCH_BLOCKS, srcBlocks);
+        this->collectChain(dest, srcBlocks.size(), destBlocks);
+
+        buffer.resize(srcBlocks.size() * BLOCK_SIZE);
+        this->readv(srcBlocks, buffer.data());
+        this->writev(destBlocks, buffer.data());
+    }
+}
+
+// Clones a shared chain for the file about to write it, the other files keep the original chain
+int32_t FS::unshare(int32_t first, size_t size, int32_t hint) {
+    std::lock_guard<std::mutex> guard(this->sharesLock);
+    auto found = this->shares.find(first);
+    if (found == this->shares.end()) return first;
+
+    int32_t clone = this->reserve(size, hint);
+    if (clone == -1) return -1;
+    this->copyChain(first, clone);
+    this->dropShare(found);
+    return clone;
+}
+
+// Frees a chain, or only drops a reference to it if another file shares it
+void FS::dropChain(int32_t first) {
+    {
+        std::lock_guard<std::mutex> guard(this->sharesLock);
+        auto found = this->shares.find(first);
+        if (found != this->shares.end()) {
+            this->dropShare(found);
+            return;
+        }
+    }
+    this->free(first);
+}
+
+// Copies an open handle so it can be used without handleLock
+bool FS::getHandle(int handle, int mode, Handle& open) {
+    std::lock_guard<std::mutex> guard(this->handleLock);
+    if (handle < 0 || size_t(handle) >= this->handles.size()) return false;
+    open = this->handles[handle];
+    return open.dirBlock != -1 && (open.mode & mode) == mode;
+}
+
+// Finds the entry of an open file through the index of its directory
+bool FS::findHandle(const Handle& open, dir_entry& file, DirLocation& location) {
+    // The index of a directory is keyed by its first block, which is all it needs from the directory entry
+    dir_entry dir{};
+    dir.type = TYPE_DIR;
+    this->setFirstBlk(dir, open.dirBlock);
+    if (!this->findEntry(dir, open.name, location)) return false;
+    file = this->readEntry(location.fatIndex, location.blockIndex);
+    return file.type == TYPE_FILE;
+}
+
+// Writes a directory entry to its place in the directory block, leaving the other entries as they are
+void FS::writeEntry(int32_t dirBlock, const DirLocation& location, const dir_entry& entry) {
+    this->cache.write(location.fatIndex, location.blockIndex * sizeof(dir_entry), sizeof(dir_entry),
+                      (const uint8_t*)&entry);
+    this->dirChanged(dirBlock);
+}
+
+// Clones a shared chain for a file about to be written, the entry points at the clone right away so that it stays
+// valid if the write fails
+bool FS::ownChain(dir_entry& file, int32_t dirBlock, const DirLocation& location) {
+    int32_t own = this->unshare(this->firstBlk(file), file.size, dirBlock);
+    if (own == -1) return false;
+    if (own != int32_t(this->firstBlk(file))) {
+        this->setFirstBlk(file, own);
+        this->writeEntry(dirBlock, location, file);
+    }
+    return true;
+}
+
+// Writes data into a chain a batch of blocks at a time, only blocks partly covered by the data are read
+bool FS::writeRange(const dir_entry& file, const char* data, uint64_t offset, size_t length) {
+    int32_t first = this->firstBlk(file);
+    std::shared_ptr<Tail> lastTail = this->tail(first, file.size);
+    Tail& tail = *lastTail;
+    {
+        std::lock_guard<std::mutex> guard(this->tailLock);
+        this->writeTail(tail);
+    }
+
+    // Links the missing blocks after the last one, a file always has at least one block
+    uint64_t end = std::max<uint64_t>(file.size, offset + length);
+    size_t usedBlocks = blocksFor(file.size);
+    size_t oldBlocks = std::max<size_t>(1, usedBlocks);
+    size_t newBlocks = std::max<size_t>(1, blocksFor(end));
+    if (newBlocks > oldBlocks) {
+        int32_t extra = this->reserve((newBlocks - oldBlocks) * BLOCK_SIZE, tail.lastBlock);
+        if (extra == -1) return false;
+        this->fat.set(tail.lastBlock, extra);
+    }
+
+    // Writing past the end starts at the old end so the gap gets zeros, bytes past the end are already zero
+    uint64_t start = std::min<uint64_t>(offset, file.size);
+    size_t index = start / BLOCK_SIZE;
+    int32_t nextFat = this->seekChain(first, index);
+    std::vector<int32_t> blocks;
+    std::vector<char> buffer;
+    while (index < newBlocks) {
+        this->collectChain(nextFat, std::min(IO_BATCH_BLOCKS, newBlocks - index), blocks);
+        if (blocks.empty()) throw std::runtime_error("Reached end of file before expected in writeRange()!");
+        buffer.assign(blocks.size() * BLOCK_SIZE, 0);
+
+        // Blocks that hold data and are not overwritten as a whole are read first
+        for (size_t i = 0; i < blocks.size(); i++) {
+            uint64_t blockStart = uint64_t(index + i) * BLOCK_SIZE;
+            bool covered = offset <= blockStart && blockStart + BLOCK_SIZE <= offset + length;
+            if (!covered && index + i < usedBlocks)
+                this->readv(std::vector<int32_t>{blocks[i]}, buffer.data() + i * BLOCK_SIZE);
+        }
+
+        // Copies the part of the data that falls in this batch
+        uint64_t batchStart = uint64_t(index) * BLOCK_SIZE;
+        uint64_t from = std::max(offset, batchStart);
+        uint64_t to = std::min<uint64_t>(offset + length, batchStart + buffer.size());
+        if (from < to) std::copy(data + (from - offset), data + (to - offset), buffer.begin() + (from - batchStart));
+
+        this->writev(blocks, buffer.data());
+        index += blocks.size();
+        if (index == newBlocks) tail.lastBlock = blocks.back();
+    }
+
+    // The tail holds the new last block
+    if (end & BLOCK_MASK) this->read(tail.lastBlock, tail.data);
+    return true;
+}
+
+// Follows a chain from the closest indexed block, indexing every CHAIN_SKIP-th block passed on the way
+int32_t FS::seekChain(int32_t first, size_t index) {
+    size_t position;
+    int32_t block;
+    size_t known;
+    {
+        std::lock_guard<std::mutex> guard(this->chainLock);
+        auto found = this->chainIndexes.find(first);
+        if (found == this->chainIndexes.end()) {
+            if (this->chainIndexes.size() >= CHAIN_INDEX_FILES) this->chainIndexes.erase(this->chainIndexes.begin());
+            found = this->chainIndexes.emplace(first, std::vector<int32_t>{first}).first;
+        }
+        const std::vector<int32_t>& skips = found->second;
+        position = std::min(index / CHAIN_SKIP, skips.size() - 1) * CHAIN_SKIP;
+        block = skips[position / CHAIN_SKIP];
+        known = skips.size();
+    }
+
+    // The chain is followed without chainLock and the new blocks are indexed unless someone else got there first
+    std::vector<int32_t> passed;
+    while (position < index && block != FAT_EOF) {
+        block = this->fat.get(block);
+        position++;
+        if (position % CHAIN_SKIP == 0 && position / CHAIN_SKIP == known + passed.size() && block != FAT_EOF)
+            passed.push_back(block);
+    }
+    if (!passed.empty()) {
+        std::lock_guard<std::mutex> guard(this->chainLock);
+        auto found = this->chainIndexes.find(first);
+        if (found != this->chainIndexes.end() && found->second.size() == known)
+            found->second.insert(found->second.end(), passed.begin(), passed.end());
+    }
+    return block;
+}
+
+// Keeps the indexed blocks that are still part of the chain
+void FS::trimChainIndex(int32_t first, size_t blocks) {
+    std::lock_guard<std::mutex> guard(this->chainLock);
+    auto found = this->chainIndexes.find(first);
+    if (found == this->chainIndexes.end()) return;
+    size_t keep = std::max<size_t>(1, (blocks + CHAIN_SKIP - 1) / CHAIN_SKIP);
+    if (found->second.size() > keep) found->second.resize(keep);
+}
+
+// Returns the cached end of a chain, walking the chain and reading its last block only on first access
+std::shared_ptr<FS::Tail> FS::tail(int32_t first, size_t size) {
+    {
+        std::lock_guard<std::mutex> guard(this->tailLock);
+        auto found = this->tails.find(first);
+        if (found != this->tails.end()) return found->second;
+    }
+
+    // Only the thread holding the lock of the file adds its tail, so the chain is walked without tailLock
+    std::shared_ptr<Tail> tail = std::make_shared<Tail>();
+    tail->lastBlock = this->seekChain(first, std::max<size_t>(1, blocksFor(size)) - 1);
+    while (this->fat.get(tail->lastBlock) != FAT_EOF) tail->lastBlock = this->fat.get(tail->lastBlock);
+    tail->pending = false;
+    if (size & BLOCK_MASK) this->read(tail->lastBlock, tail->data);
+
+    // Makes room by writing out and dropping a tail no other operation holds
+    std::lock_guard<std::mutex> guard(this->tailLock);
+    if (this->tails.size() >= TAIL_CACHE_FILES) {
+        for (auto victim = this->tails.begin(); victim != this->tails.end(); victim++) {
+            if (victim->second.use_count() > 1) continue;
+            this->writeTail(*victim->second);
+            this->tails.erase(victim);
+            break;
+        }
+    }
+    this->tails[first] = tail;
+    return tail;
+}
+
+// Moves a tail to a new last block, the old last block was written by the caller
+void FS::moveTail(Tail& tail, int32_t first, int32_t lastBlock, bool pending) {
+    std::lock_guard<std::mutex> guard(this->tailLock);
+    if (tail.pending) this->pendingTails.erase(tail.lastBlock);
+    tail.lastBlock = lastBlock;
+    tail.pending = pending;
+    if (pending) this->pendingTails[lastBlock] = first;
+}
+
+// Writes the last block of a file if batched appends left data in it, the caller holds tailLock
+void FS::writeTail(Tail& tail) {
+    if (!tail.pending) return;
+    this->writev(std::vector<int32_t>{tail.lastBlock}, tail.data.data());
+    this->pendingTails.erase(tail.lastBlock);
+    tail.pending = false;
+}
+
+// Changes how blocks are picked, nothing is allocated meanwhile
+void FS::setAllocPolicy(AllocPolicy policy) {
+    std::lock_guard<std::mutex> guard(this->allocLock);
+    this->allocPolicy = policy;
+}
+
+// Turns batched appends on or off, turning them off writes what they gathered
+void FS::setAppendBatching(bool enabled) {
+    Operation op(this, OpStats::FLUSH, true);
+    this->batchAppends = enabled;
+    if (!enabled) this->writeTails();
+}
+
+// Writes the last block of every file that batched appends left data in, with no other operation running
+int FS::flushAppends() {
+    Operation op(this, OpStats::FLUSH, true);
+    return this->writeTails();
+}
+
+// Writes the last block of every file that batched appends left data in and flushes the block cache
+int FS::writeTails() {
+    {
+        std::lock_guard<std::mutex> guard(this->tailLock);
+        for (auto& tail : this->tails) this->writeTail(*tail.second);
+    }
+    return this->cache.flush();
+}
+
 // Frees the linked lists FAT entries by setting them to FAT_FREE
-void FS::free(int16_t fatStart) {
-    int16_t fatIndex = fatStart;
+void FS::free(int32_t fatStart, bool dir) {
+    // A directory that started here is gone, so neither its index nor paths through it may be found by a new
+    // directory in the same block
+    {
+        std::lock_guard<std::mutex> guard(this->dirIndexLock);
+        this->dirIndexes.erase(fatStart);
+    }
+    this->dirChanged(fatStart);
+
+    // Neither is the tail or the index of a file that started here, data gathered in the tail is dropped along
+    // with the file
+    {
+        std::lock_guard<std::mutex> guard(this->chainLock);
+        this->chainIndexes.erase(fatStart);
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->tailLock);
+        auto found = this->tails.find(fatStart);
+        if (found != this->tails.end()) {
+            if (found->second->pending) this->pendingTails.erase(found->second->lastBlock);
+            this->tails.erase(found);
+        }
+    }
+
+    // Another operation may still hold a removed directory it has not locked yet, or a session may be in it, and
+    // either would take a new directory in the same block for it
+    std::lock_guard<std::mutex> guard(this->allocLock);
+    int32_t fatIndex = fatStart;
+    if (dir) {
+        fatIndex = this->fat.get(fatStart);
+        this->fat.set(fatStart, FAT_FREE);
+        this->dirFrees.push_back(fatStart);
+        this->dirFreesDue = true;
+    }
     while (fatIndex != FAT_EOF) {
-        int16_t temp = fatIndex;
-        fatIndex = this->fat[fatIndex];
-        this->fat[temp] = FAT_FREE;
+        int32_t temp = fatIndex;
+        fatIndex = this->fat.get(fatIndex);
+        this->releaseFat(temp);
     }
 }
 
@@ -767,36 +2237,36 @@ bool FS::addDirEntry(const dir_entry& dir, dir_entry newEntry) {
     // Validity checks
     dir_entry temp;
     if (std::string("").compare(newEntry.file_name) == 0) return false;
-    if (this->workingPath.searchDir(dir, std::string(newEntry.file_name), temp)) {
+    if (this->path().searchDir(dir, std::string(newEntry.file_name), temp)) {
         return false;
     }
 
-    // Goes through the FAT until it reaches the FAT_EOF
-    int16_t fatIndex = dir.first_blk;
-    while (this->fat[fatIndex] != FAT_EOF) {
-        fatIndex = this->fat[fatIndex];
+    // Large linear directories become B-trees, which take every entry from then on
+    DirIndex& index = this->dirIndex(dir);
+    if (!index.tree.root && this->treeDirs && index.entries.size() >= DIR_TREE_ENTRIES) this->makeTree(dir, index);
+    if (index.tree.root) {
+        if (!this->treeInsert(dir, index, newEntry)) return false;
+        this->dirChanged(this->firstBlk(dir));
+        return true;
     }
 
-    // Reads in the last block in the directory
-    dir_block dirBlock{};
-    this->read(fatIndex, dirBlock);
-
-    // Looks for the first free slot in the block
-    int dirEntryIndexInBlock;
-    for (dirEntryIndexInBlock = 0; dirEntryIndexInBlock < FS::DIR_BLK_SIZE; dirEntryIndexInBlock++) {
-        if (!isNotFreeEntry(dirBlock[dirEntryIndexInBlock])) break;
-    }
+    // The index knows the last block in the directory and how many entries it holds
+    int32_t fatIndex = index.lastBlock;
+    int dirEntryIndexInBlock = index.lastCount;
 
     // Adds a new FAT block if we don't have enough space in the directory for the dir_entry
     if (dirEntryIndexInBlock == FS::DIR_BLK_SIZE) {
         dirEntryIndexInBlock = 0;
-        int16_t newDirBlock = this->getEmptyFat();
+        int32_t newDirBlock;
+        {
+            std::lock_guard<std::mutex> guard(this->allocLock);
+            newDirBlock = this->allocFat(fatIndex);
+        }
         if (newDirBlock == -1) {
             return false;
         }
-        this->fat[fatIndex] = newDirBlock;
-        this->fat[newDirBlock] = FAT_EOF;
-        fatIndex = this->fat[fatIndex];
+        this->fat.set(fatIndex, newDirBlock);
+        fatIndex = this->fat.get(fatIndex);
 
         // Add metadata for new file
         dir_block freshDirBlock{};
@@ -806,77 +2276,340 @@ bool FS::addDirEntry(const dir_entry& dir, dir_entry newEntry) {
         // If there is enough space in the directory
     } else {
         // Add metadata for new file
+        dir_block dirBlock{};
+        this->read(fatIndex, dirBlock);
         dirBlock[dirEntryIndexInBlock] = newEntry;
         this->write(fatIndex, dirBlock);
     }
 
-    // Writes updates to the FAT block
-    this->writeFat();
+    // Keeps the index and the dentry cache up to date
+    this->dirChanged(this->firstBlk(dir));
+    index.entries[entryName(newEntry)] = DirLocation{fatIndex, dirEntryIndexInBlock};
+    index.lastBlock = fatIndex;
+    index.lastCount = dirEntryIndexInBlock + 1;
+
     return true;
 }
 
 // Removes entry by searching through the directory and then replaces it with the last entry
 bool FS::removeDirEntry(dir_entry& dir, std::string fileName) {
-    int16_t entryFatIndex;
+    int32_t entryFatIndex;
     int removeDirEntryIndex;
     dir_entry entryToRemove;
 
     // Looks for the entry and saves the FAT table index, the entry and its index in the FAT block
-    if (!this->workingPath.searchDir(dir, fileName, entryToRemove, entryFatIndex, removeDirEntryIndex)) {
+    if (!this->path().searchDir(dir, fileName, entryToRemove, entryFatIndex, removeDirEntryIndex)) {
         return false;
     }
 
-    // Goes through the FAT until it reaches the FAT_EOF
-    int16_t fatIndex = dir.first_blk;
-    while (this->fat[fatIndex] != FAT_EOF) {
-        fatIndex = this->fat[fatIndex];
+    // A B-tree closes the gap within the leaf
+    DirIndex& index = this->dirIndex(dir);
+    if (index.tree.root) {
+        this->treeRemove(dir, index, DirLocation{entryFatIndex, removeDirEntryIndex});
+        this->dirChanged(this->firstBlk(dir));
+        return true;
     }
 
+    // The index knows the last block in the directory and how many entries it holds
+    int32_t fatIndex = index.lastBlock;
+    int dirEntryIndexInBlock = index.lastCount - 1;
+
     // Reads in the last block in the directory
     dir_block dirBlock{};
     this->read(fatIndex, dirBlock);
 
-    // Looks for the last non free slot in the block
-    int16_t dirEntryIndexInBlock;
-    for (dirEntryIndexInBlock = 0; dirEntryIndexInBlock < FS::DIR_BLK_SIZE; dirEntryIndexInBlock++) {
-        if (!isNotFreeEntry(dirBlock[dirEntryIndexInBlock])) break;
-    }
-    dirEntryIndexInBlock--;
-
     // Marks last free slot
     dir_entry entryToMove = dirBlock[dirEntryIndexInBlock];
     dirBlock[dirEntryIndexInBlock].file_name[0] = 0;
     this->write(fatIndex, dirBlock);
+    this->dirChanged(this->firstBlk(dir));
+    index.entries.erase(entryName(entryToRemove));
 
     // Move last data to space where the entry was removed
     if (dirEntryIndexInBlock != removeDirEntryIndex || fatIndex != entryFatIndex) {
         this->read(entryFatIndex, dirBlock);
         dirBlock[removeDirEntryIndex] = entryToMove;
         this->write(entryFatIndex, dirBlock);
+        index.entries[entryName(entryToMove)] = DirLocation{entryFatIndex, removeDirEntryIndex};
     }
+    index.lastCount--;
 
-    // Updates the FAT_EOF
+    // Updates the FAT_EOF by freeing the now empty last block and ending the chain at the block before it
     if (dirEntryIndexInBlock == 0) {
-        this->fat[fatIndex] = FAT_FREE;
-        while (this->fat[this->fat[fatIndex]] != FAT_FREE) {
-            fatIndex = this->fat[fatIndex];
+        {
+            std::lock_guard<std::mutex> guard(this->allocLock);
+            this->releaseFat(fatIndex);
         }
-        this->fat[fatIndex] = FAT_EOF;
+        fatIndex = this->firstBlk(dir);
+        while (this->fat.get(this->fat.get(fatIndex)) != FAT_FREE) {
+            fatIndex = this->fat.get(fatIndex);
+        }
+        this->fat.set(fatIndex, FAT_EOF);
+        index.lastBlock = fatIndex;
+        index.lastCount = FS::DIR_BLK_SIZE;
     }
 
-    // Writes updates to the FAT block
-    this->writeFat();
     return true;
 }
 
+// A linear directory has every name in its index, a B-tree is searched from the root down to a leaf
+bool FS::findEntry(const dir_entry& dir, const std::string& name, DirLocation& location) {
+    const DirIndex& index = this->dirIndex(dir);
+    if (!index.tree.root) {
+        auto found = index.entries.find(name);
+        if (found == index.entries.end()) return false;
+        location = found->second;
+        return true;
+    }
+
+    // "." and ".." stay at the start of the first block
+    if (name == "." || name == "..") {
+        location = DirLocation{int32_t(this->firstBlk(dir)), name == "." ? 0 : 1};
+        return true;
+    }
+    BlockCache::View view;
+    int32_t block = index.tree.root;
+    for (uint32_t level = 0; level < index.tree.height; level++) {
+        const dir_block& node = this->viewDir(block, view);
+        dir_tree_node header = nodeHeader(node);
+        int slot = treeSlot(node, header, name);
+        if (!header.leaf) {
+            block = node[slot].size;
+            continue;
+        }
+        if (slot > int(header.count) ||
+            std::strncmp(node[slot].file_name, name.c_str(), sizeof(dir_entry::file_name)) != 0)
+            return false;
+        location = DirLocation{block, slot};
+        return true;
+    }
+    return false;
+}
+
+// The slot after ".." is free in an empty linear directory and holds the header of a B-tree
+bool FS::dirEmpty(const dir_entry& dir) {
+    dir_entry third = this->readEntry(this->firstBlk(dir), 2);
+    dir_tree_header header;
+    std::memcpy(&header, &third, sizeof(header));
+    if (header.zero == 0 && header.magic == DIR_TREE_MAGIC) return header.count == 0;
+    return !isNotFreeEntry(third);
+}
+
+// Builds the tree bottom up from the sorted entries with full leaves, every level above holds the first name and the
+// block of every node below it until a level has a single node, the root
+bool FS::makeTree(const dir_entry& dir, DirIndex& index) {
+    int32_t first = this->firstBlk(dir);
+
+    // Gathers the entries after "." and ".." and the blocks after the first
+    std::vector<dir_entry> records;
+    std::vector<int32_t> blocks;
+    for (int32_t fatIndex = first; fatIndex != FAT_EOF; fatIndex = this->fat.get(fatIndex)) {
+        if (fatIndex != first) blocks.push_back(fatIndex);
+        BlockCache::View view;
+        const dir_block& node = this->viewDir(fatIndex, view);
+        for (int i = fatIndex == first ? 2 : 0; i < FS::DIR_BLK_SIZE && isNotFreeEntry(node[i]); i++)
+            records.push_back(node[i]);
+    }
+    std::sort(records.begin(), records.end(), [](const dir_entry& a, const dir_entry& b) {
+        return std::strncmp(a.file_name, b.file_name, sizeof(dir_entry::file_name)) < 0;
+    });
+    uint32_t count = records.size();
+
+    // Counts the nodes on every level, leaves first, and links the blocks missing for them
+    std::vector<size_t> levels(1, std::max<size_t>(1, (records.size() + TREE_NODE_SIZE - 1) / TREE_NODE_SIZE));
+    while (levels.back() > 1) levels.push_back((levels.back() + TREE_NODE_SIZE - 1) / TREE_NODE_SIZE);
+    size_t nodes = 0;
+    for (size_t level : levels) nodes += level;
+    int32_t last = blocks.empty() ? first : blocks.back();
+    if (blocks.size() < nodes && !this->extendDir(last, nodes - blocks.size(), blocks)) return false;
+    if (blocks.size() > nodes) {
+        std::lock_guard<std::mutex> guard(this->allocLock);
+        for (size_t i = nodes; i < blocks.size(); i++) this->releaseFat(blocks[i]);
+        this->fat.set(blocks[nodes - 1], FAT_EOF);
+        blocks.resize(nodes);
+        last = blocks.back();
+    }
+
+    dir_block node{};
+    size_t used = 0;
+    for (size_t level = 0; level < levels.size(); level++) {
+        std::vector<dir_entry> keys;
+        for (size_t i = 0; i < levels[level]; i++) {
+            int32_t block = blocks[used + i];
+            size_t begin = i * TREE_NODE_SIZE;
+            size_t end = std::min(records.size(), begin + TREE_NODE_SIZE);
+            dir_tree_node header{};
+            header.magic = DIR_TREE_MAGIC;
+            header.leaf = level == 0;
+            header.count = end - begin;
+            header.next = level == 0 && i + 1 < levels[level] ? blocks[used + i + 1] : 0;
+            node.fill(dir_entry{});
+            setNodeHeader(node, header);
+            std::copy(records.begin() + begin, records.begin() + end, node.begin() + 1);
+            this->write(block, node);
+
+            // The leftmost node on every level is found by an empty name
+            dir_entry key{};
+            if (i > 0) entryName(records[begin]).copy(key.file_name, sizeof(key.file_name));
+            key.size = block;
+            keys.push_back(key);
+        }
+        used += levels[level];
+        records.swap(keys);
+    }
+
+    // Only "." and ".." and the header are left in the first block
+    index.tree = dir_tree_header{};
+    index.tree.magic = DIR_TREE_MAGIC;
+    index.tree.root = blocks.back();
+    index.tree.last = last;
+    index.tree.count = count;
+    index.tree.height = levels.size();
+    this->read(first, node);
+    std::fill(node.begin() + 2, node.end(), dir_entry{});
+    std::memcpy(&node[2], &index.tree, sizeof(index.tree));
+    this->write(first, node);
+    index.entries.clear();
+    index.lastBlock = last;
+    index.lastCount = 0;
+    this->dirChanged(first);
+    return true;
+}
+
+// On failure the blocks already taken are released and the chain ends where it did
+bool FS::extendDir(int32_t& last, size_t count, std::vector<int32_t>& blocks) {
+    std::lock_guard<std::mutex> guard(this->allocLock);
+    int32_t end = last;
+    size_t had = blocks.size();
+    while (blocks.size() - had < count) {
+        int32_t block = this->allocFat(last);
+        if (block == -1) {
+            for (size_t i = had; i < blocks.size(); i++) this->releaseFat(blocks[i]);
+            blocks.resize(had);
+            this->fat.set(end, FAT_EOF);
+            last = end;
+            return false;
+        }
+        this->fat.set(last, block);
+        last = block;
+        blocks.push_back(block);
+    }
+    return true;
+}
+
+// Walks down to the leaf the name belongs in and inserts the entry there. A full node is split in two, the upper half
+// going to a new node whose first name is inserted into the parent the same way, and a new root is put above a root
+// that splits. Every new node is linked to the directory before anything is written.
+bool FS::treeInsert(const dir_entry& dir, DirIndex& index, const dir_entry& entry) {
+    std::string name = entryName(entry);
+    std::vector<int32_t> path;
+    std::vector<int> slots;
+    std::vector<uint32_t> counts;
+    int32_t block = index.tree.root;
+    for (uint32_t level = 0; level < index.tree.height; level++) {
+        BlockCache::View view;
+        const dir_block& node = this->viewDir(block, view);
+        dir_tree_node header = nodeHeader(node);
+        path.push_back(block);
+        slots.push_back(treeSlot(node, header, name));
+        counts.push_back(header.count);
+        if (header.leaf) break;
+        block = node[slots.back()].size;
+    }
+
+    // Every full node from the leaf up splits, a root that splits needs one more node for the new root
+    size_t splits = 0;
+    while (splits < counts.size() && counts[counts.size() - 1 - splits] == TREE_NODE_SIZE) splits++;
+    std::vector<int32_t> fresh;
+    int32_t last = index.tree.last;
+    if (!this->extendDir(last, splits + (splits == counts.size()), fresh)) return false;
+
+    dir_entry record = entry;
+    dir_block node{};
+    size_t used = 0;
+    bool placed = false;
+    for (size_t level = path.size(); level-- > 0;) {
+        this->read(path[level], node);
+        dir_tree_node header = nodeHeader(node);
+
+        // A key goes right after the key of the child that split
+        int slot = slots[level] + !header.leaf;
+        if (header.count < TREE_NODE_SIZE) {
+            std::copy_backward(node.begin() + slot, node.begin() + header.count + 1, node.begin() + header.count + 2);
+            node[slot] = record;
+            header.count++;
+            setNodeHeader(node, header);
+            this->write(path[level], node);
+            placed = true;
+            break;
+        }
+
+        std::vector<dir_entry> records(node.begin() + 1, node.end());
+        records.insert(records.begin() + slot - 1, record);
+        uint32_t half = records.size() / 2;
+        int32_t right = fresh[used++];
+        dir_tree_node rightHeader = header;
+        rightHeader.count = records.size() - half;
+        header.count = half;
+        if (header.leaf) header.next = right;
+        node.fill(dir_entry{});
+        setNodeHeader(node, header);
+        std::copy(records.begin(), records.begin() + half, node.begin() + 1);
+        this->write(path[level], node);
+        node.fill(dir_entry{});
+        setNodeHeader(node, rightHeader);
+        std::copy(records.begin() + half, records.end(), node.begin() + 1);
+        this->write(right, node);
+
+        record = dir_entry{};
+        entryName(records[half]).copy(record.file_name, sizeof(record.file_name));
+        record.size = right;
+    }
+    if (!placed) {
+        int32_t root = fresh[used++];
+        dir_tree_node header{};
+        header.magic = DIR_TREE_MAGIC;
+        header.count = 2;
+        node.fill(dir_entry{});
+        setNodeHeader(node, header);
+        node[1].size = index.tree.root;
+        node[2] = record;
+        this->write(root, node);
+        index.tree.root = root;
+        index.tree.height++;
+    }
+
+    index.tree.last = last;
+    index.tree.count++;
+    index.lastBlock = last;
+    this->cache.write(this->firstBlk(dir), 2 * sizeof(dir_entry), sizeof(index.tree), (const uint8_t*)&index.tree);
+    return true;
+}
+
+// Leaves are never merged, so the tree keeps its shape until the directory is removed
+void FS::treeRemove(const dir_entry& dir, DirIndex& index, const DirLocation& location) {
+    dir_block node{};
+    this->read(location.fatIndex, node);
+    dir_tree_node header = nodeHeader(node);
+    std::copy(node.begin() + location.blockIndex + 1, node.begin() + header.count + 1,
+              node.begin() + location.blockIndex);
+    node[header.count] = dir_entry{};
+    header.count--;
+    setNodeHeader(node, header);
+    this->write(location.fatIndex, node);
+
+    index.tree.count--;
+    this->cache.write(this->firstBlk(dir), 2 * sizeof(dir_entry), sizeof(index.tree), (const uint8_t*)&index.tree);
+}
+
 // Adds directory entry and data
 bool FS::__create(const dir_entry& dir, dir_entry& metadata, const std::string& data) {
     // Reserves space that the new file needs
-    int16_t startfat = this->reserve(data.size());
+    int32_t startfat = this->reserve(data.size(), this->firstBlk(dir));
     if (startfat == -1) return false;
 
     // Sets metadata for the file
-    metadata.first_blk = startfat;
+    this->setFirstBlk(metadata, startfat);
     metadata.size = data.size();
 
     // Frees the entry if it fails
@@ -890,22 +2623,23 @@ bool FS::__create(const dir_entry& dir, dir_entry& metadata, const std::string&
     if (metadata.type == TYPE_DIR) {
         dir_entry dotAndDotDot[] = {metadata, dir};
         totalData = std::string((char*)dotAndDotDot, sizeof(dotAndDotDot));
-        for (int i = 0; i < sizeof("."); i++) totalData[i] = "."[i];
-        for (int i = 0; i < sizeof(".."); i++) totalData[sizeof(dir_entry) + i] = ".."[i];
+        for (size_t i = 0; i < sizeof("."); i++) totalData[i] = "."[i];
+        for (size_t i = 0; i < sizeof(".."); i++) totalData[sizeof(dir_entry) + i] = ".."[i];
     }
     totalData += data;
 
-    // Writes the data to the new entry
+    // Writes the data to the new entry a batch of blocks at a time
     size_t pos = 0;
-    int16_t fatIndex = metadata.first_blk;
+    int32_t fatIndex = this->firstBlk(metadata);
+    std::vector<int32_t> blocks;
+    std::vector<char> buffer;
     while (fatIndex != FAT_EOF) {
-        file_block buffer{};
-        totalData.copy(buffer.data(), BLOCK_SIZE, pos);
-        this->write(fatIndex, buffer);
-        pos += BLOCK_SIZE;
-        fatIndex = this->fat[fatIndex];
+        this->collectChain(fatIndex, IO_BATCH_BLOCKS, blocks);
+        buffer.assign(blocks.size() * BLOCK_SIZE, 0);
+        if (pos < totalData.size()) totalData.copy(buffer.data(), buffer.size(), pos);
+        this->writev(blocks, buffer.data());
+        pos += buffer.size();
     }
-    this->writeFat();
 
     return true;
 }
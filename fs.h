@@ -1,17 +1,40 @@
+#include <pthread.h>
+
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "alloc.h"
+#include "cache.h"
+#include "dcache.h"
+#include "direntry.h"
 #include "disk.h"
+#include "fat.h"
+#include "journal.h"
+#include "locks.h"
+#include "stats.h"
+#include "superblock.h"
 
 #ifndef __FS_H__
 #define __FS_H__
 
 #define ROOT_BLOCK 0
 #define FAT_BLOCK 1
-#define FAT_FREE 0
-#define FAT_EOF -1
+#define SUPER_BLOCK 1
+
+// Largest volumes the two FAT widths can describe, FAT_EOF must not be a valid block
+#define MAX_FAT16_BLOCKS 32767
+#define MAX_FAT32_BLOCKS 2147483647u
+
+// Length of file_name on volumes with 32-bit FAT entries, the last two bytes hold the upper half of first_blk
+#define WIDE_NAME_SIZE 54
 
 #define TYPE_FILE 0
 #define TYPE_DIR 1
@@ -19,33 +42,39 @@
 #define WRITE 0x02
 #define EXECUTE 0x01
 
-struct dir_entry {
-    char file_name[56];     // name of the file / sub-directory
-    uint32_t size;          // size of the file in bytes
-    uint16_t first_blk;     // index in the FAT for the first block of the file
-    uint8_t type;           // directory (1) or file (0)
-    uint8_t access_rights;  // read (0x04), write (0x02), execute (0x01)
-};
-
+/// @brief File system stored in a disk file. Every operation may be called from many threads at once, directories and
+/// files have reader/writer locks of their own so operations on different ones don't wait for each other.
 class FS {
    public:
-    static const int FAT_SIZE = BLOCK_SIZE / 2;
     static const int DIR_BLK_SIZE = BLOCK_SIZE / sizeof(dir_entry);
 
-    FS();
+    /// @param backend How the disk file is read and written.
+    FS(Disk::Backend backend = Disk::MMAP);
     ~FS();
     // formats the disk, i.e., creates an empty file system
     int format();
+    // format <blocks> <fatbits> resizes the disk to <blocks> blocks and
+    // formats it with <fatbits> (16 or 32) bit FAT entries
+    int format(uint32_t blocks, int fatBits);
     // create <filepath> creates a new file on the disk, the data content is
     // written on the following rows (ended with an empty row)
     int create(std::string filepath);
+    // create <filepath> with the rows read from input instead of stdin, or
+    // with everything up to the end of input if wholeStream is set
+    int create(std::string filepath, std::istream& input, bool wholeStream = false);
     // cat <filepath> reads the content of a file and prints it on the screen
     int cat(std::string filepath);
+    // cat <filepath> writing the content to a file descriptor instead of the
+    // screen, runs of consecutive blocks are sent straight from the disk file
+    int cat(std::string filepath, int fd);
     // ls lists the content in the current directory (files and sub-directories)
     int ls();
+    // ls writing the listing to out instead of the screen
+    int ls(std::ostream& out);
 
     // cp <sourcepath> <destpath> makes an exact copy of the file
-    // <sourcepath> to a new file <destpath>
+    // <sourcepath> to a new file <destpath>, which shares the blocks of
+    // <sourcepath> until either file is written
     int cp(std::string sourcepath, std::string destpath);
     // mv <sourcepath> <destpath> renames the file <sourcepath> to the name
     // <destpath>, or moves the file <sourcepath> to the directory <destpath>
@@ -57,28 +86,152 @@ class FS {
     // to the end of file <filepath2>. The file <filepath1> is unchanged.
     int append(std::string filepath1, std::string filepath2);
 
+    // how mkdir() stores the entries of new directories
+    enum DirFormat {
+        LINEAR,  // an unsorted array, turned into a B-tree once it grows large
+        BTREE    // a B-tree sorted by name from the start
+    };
+
     // mkdir <dirpath> creates a new sub-directory with the name <dirpath>
     // in the current directory
     int mkdir(std::string dirpath);
+    // mkdir <dirpath> storing the new directories in format, volumes
+    // without B-tree directories store them LINEAR
+    int mkdir(std::string dirpath, DirFormat format);
     // cd <dirpath> changes the current (working) directory to the directory
     // named <dirpath>
     int cd(std::string dirpath);
     // pwd prints the full path, i.e., from the root directory, to the current
     // directory, including the current directory name
     int pwd();
+    // pwd writing the path to out instead of the screen
+    int pwd(std::ostream& out);
 
     // chmod <accessrights> <filepath> changes the access rights for the
     // file <filepath> to <accessrights>.
     int chmod(std::string accessrights, std::string filepath);
 
+    // sync writes every modified block held in memory back to the disk,
+    // or commits it to the journal, so that it survives a crash
+    int sync();
+
+    // stats prints the calls, latency percentiles, disk blocks and directory
+    // blocks of every kind of operation since the counters were last reset,
+    // followed by the disk, cache, FAT and journal counters
+    int stats(std::ostream& out);
+
+    // open <filepath> opens a file for random access with mode READ, WRITE
+    // or both, returns a handle or -1 if the file can't be opened that way
+    int open(std::string filepath, int mode);
+    // pread reads up to length bytes at offset of an open file, returns the
+    // amount of bytes read, 0 at the end of the file, or -1
+    int64_t pread(int handle, char* data, size_t length, uint64_t offset);
+    // pwrite writes length bytes at offset of an open file, a file written
+    // past its end grows and the gap reads as zeros, returns length or -1
+    int64_t pwrite(int handle, const char* data, size_t length, uint64_t offset);
+    // truncate shrinks or grows an open file to size bytes, new bytes read
+    // as zeros
+    int truncate(int handle, uint64_t size);
+    // close closes a handle returned by open
+    int close(int handle);
+
+    // openSession starts a session with a working directory of its own at
+    // the root, returns its id
+    int openSession();
+    // useSession makes the calling thread resolve paths from the working
+    // directory of a session, or from the shared one if session is -1
+    int useSession(int session);
+    // closeSession ends a session, the calling thread goes back to the
+    // shared working directory if it used it, no other thread may still use it
+    int closeSession(int session);
+
+    // how reserve() places the blocks of new files and directories
+    enum AllocPolicy {
+        FIRST_FIT,  // the lowest free blocks, wherever they are
+        CONTIGUOUS  // one run close to the parent directory, or else the fewest possible runs
+    };
+
+    /// @brief Chooses how new blocks are placed on the disk, CONTIGUOUS by default.
+    /// @param policy The allocation policy.
+    void setAllocPolicy(AllocPolicy policy);
+
+    /// @return Hit, miss, eviction and writeback counters of the block cache.
+    inline const BlockCache::Stats& cacheStats() const { return this->cache.stats(); }
+
+    /// @return Hit, miss and invalidation counters of the dentry cache.
+    inline const DentryCache::Stats& dentryStats() const { return this->dentries.stats(); }
+
+    /// @return Counters comparing the FAT entries changed with the FAT blocks written.
+    inline const Fat::Stats& fatStats() const { return this->fat.stats(); }
+
+    /// @return Commit, checkpoint and replay counters of the metadata journal.
+    inline const Journal::Stats& journalStats() const { return this->journal.stats(); }
+
+    /// @return Amounts of blocks read from and written to the disk file.
+    inline Disk::Stats diskStats() const { return this->disk.get_stats(); }
+
+    /// @return Calls, latency histogram, disk blocks and directory blocks of every kind of operation.
+    inline const OpStats& opStats() const { return this->ops; }
+
+    /// @brief Sets the operation, disk, block cache, dentry cache, FAT and journal counters to zero, waiting for the
+    /// running operations to finish first.
+    void resetStats();
+
+    /// @brief Gathers small appends in memory, only blocks that fill up are written until flushAppends() is called
+    /// or batching is turned off. Gathered data is read back by every operation but is lost in a crash.
+    /// @param enabled Whether appends are batched, off by default.
+    void setAppendBatching(bool enabled);
+
+    /// @brief Writes what batched appends have gathered and flushes the block cache.
+    /// @return 0 if succeeded else -1.
+    int flushAppends();
+
+    /// @brief Changes the maximum amount of blocks held by the block cache.
+    /// @param blocks Maximum amount of cached blocks.
+    inline void setCacheSize(size_t blocks) { this->cache.resize(blocks); }
+
    private:
+    /// @brief Held by every public operation for as long as it runs. Operations share it, a group commit of the
+    /// journal takes it exclusively so that a transaction never holds half an operation.
+    class Operation {
+       public:
+        /// @brief Waits until the operation may start, the wait is counted in its latency.
+        /// @param fs The file system.
+        /// @param kind The kind of operation it is counted as.
+        /// @param exclusive Whether no other operation may run at the same time.
+        Operation(FS* fs, OpStats::Op kind, bool exclusive = false);
+
+        /// @brief Ends the operation, commits the journal if the group is due and counts the operation. What an
+        /// operation that returned without finish() changed is written first.
+        ~Operation();
+
+        Operation(const Operation&) = delete;
+        Operation& operator=(const Operation&) = delete;
+
+        /// @brief Writes what the operation changed, see endOperation().
+        /// @return 0 if succeeded else -1.
+        int finish();
+
+       private:
+        /// @brief Releases the operation lock and commits the journal if the group is due, or gives back the blocks of
+        /// removed directories.
+        void end();
+
+        FS* fs;
+        OpStats::Op kind;
+        bool exclusive;
+        bool finished;
+        std::chrono::steady_clock::time_point start;
+        // What the thread does until the operation ends, the commit included
+        OpStats::Activity activity;
+    };
+
     /// @brief Helper class to handle paths for the file system.
     class Path {
        public:
-        /// @brief Binds path to disk and FAT and initilizes working directory.
-        /// @param disk The disk.
-        /// @param fat The FAT.
-        Path(Disk* disk, int16_t* fat);
+        /// @brief Binds path to the file system and initilizes working directory.
+        /// @param fs The file system whose blocks and FAT the path reads.
+        Path(FS* fs);
 
         Path(const Path& other) = default;
 
@@ -97,21 +250,44 @@ class FS {
         /// @return True if found else false.
         bool findUpToLast(const std::string& path, dir_entry& result, std::string& last) const;
 
-        /// @brief Searches for a specified file in the directory.
+        /// @brief Resolves a path from the working directory without using the dentry cache.
+        /// @param path The path to resolve.
+        /// @param upToLast Whether to stop before the last component.
+        /// @param result The directory entry the path points to.
+        /// @param last Last component in the path if upToLast is set.
+        /// @param dirs First blocks of the directories that were searched.
+        /// @return True if found else false.
+        bool walk(const std::string& path, bool upToLast, dir_entry& result, std::string& last,
+                  std::vector<int32_t>& dirs) const;
+
+        /// @brief Makes the dentry cache key for a path.
+        /// @param kind Tells find() and findUpToLast() results apart.
+        /// @param path The path.
+        /// @return The key.
+        std::string dentryKey(char kind, const std::string& path) const;
+
+        /// @brief Searches for a specified file in the directory, the caller holds the lock of the directory.
         /// @param dir The directory to search.
         /// @param fileName The file name to be searched for.
         /// @param result The directory entry to the found file/directory.
         /// @return True if found else false.
         inline bool searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result) const;
 
-        /// @brief Searches for a specified file in the directory.
+        /// @brief Searches for a specified file in the directory while holding the lock of the directory.
+        /// @param dir The directory to search.
+        /// @param fileName The file name to be searched for.
+        /// @param result The directory entry to the found file/directory.
+        /// @return True if found else false.
+        bool lookup(const dir_entry& dir, const std::string& fileName, dir_entry& result) const;
+
+        /// @brief Searches for a specified file in the directory, the caller holds the lock of the directory.
         /// @param dir The directory to search.
         /// @param fileName The file name to be searched for.
         /// @param result The directory entry to the found file/directory.
         /// @param fatIndex The index to the FAT block that @result was found in.
         /// @param blockIndex The index in the FAT block that points to @result.
         /// @return True if found else false.
-        bool searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result, int16_t& fatIndex,
+        bool searchDir(const dir_entry& dir, const std::string& fileName, dir_entry& result, int32_t& fatIndex,
                        int& blockIndex) const;
 
         /// @brief Adds path to current path.
@@ -120,7 +296,7 @@ class FS {
         bool cd(const std::string& path);
 
         /// @return Entry for working directory.
-        inline const dir_entry& workingDir() const { return this->path.back(); }
+        dir_entry workingDir() const;
 
         /// @return Root entry.
         inline const dir_entry& rootDir() const { return this->path.front(); }
@@ -140,67 +316,443 @@ class FS {
         /// @param newData The new data to be set.
         void updatePathEntry(const dir_entry& entry, dir_entry newData);
 
+        /// @brief Checks whether the path goes through a directory, the caller holds pathLock.
+        /// @param first The first block of the directory.
+        /// @return True if found else false.
+        bool contains(int32_t first) const;
+
        private:
-        Disk* disk;
-        int16_t* fat;
+        FS* fs;
         std::vector<dir_entry> path;
     };
 
+    /// @return The working path of the session the calling thread uses, see useSession().
+    Path& path();
+
+    /// @brief Where a directory entry is stored.
+    struct DirLocation {
+        int32_t fatIndex;  // the directory block the entry is in
+        int blockIndex;    // the index of the entry in that block
+    };
+
+    /// @brief In-memory index of one directory. A directory stored as a B-tree is searched on disk, so only its header
+    /// is kept.
+    struct DirIndex {
+        std::unordered_map<std::string, DirLocation> entries;  // every entry of a linear directory
+        int32_t lastBlock;     // the last block in the directory
+        int lastCount;         // amount of entries in the last block of a linear directory
+        dir_tree_header tree;  // header of a B-tree directory, its root is 0 if the directory is linear
+    };
+
+    /// @brief A file opened for random access. The file is looked up by name in its directory on every access so the
+    /// handle follows the entry when other entries of the directory move.
+    struct Handle {
+        int32_t dirBlock;  // first block of the directory the file is in, -1 if the handle is closed
+        std::string name;  // name of the file
+        int mode;          // READ, WRITE or both
+    };
+
+    /// @brief Cached end of a file chain, so that append neither walks the chain nor reads the last block. Only the
+    /// thread holding the lock of the file changes it.
+    struct Tail {
+        int32_t lastBlock;                  // the last block in the chain
+        std::array<char, BLOCK_SIZE> data;  // the last block, valid up to the size of the file
+        bool pending;                       // the last block holds batched appends that are not written yet
+    };
+
+    struct Share {
+        uint32_t refs;  // amount of extra files using the chain
+        uint32_t slot;  // index of the entry in the share table
+    };
+
+    // Shared by every running operation, see Operation
+    pthread_rwlock_t opLock;
+    std::atomic<int> activeOps;
+    std::atomic<bool> commitDue;
+    std::atomic<bool> dirFreesDue;
+
+    // Counters of the finished operations
+    OpStats ops;
+
+    // Locks of directories and files. The mutexes further down guard the state that follows them, they are taken
+    // after the locks of directories and files and never held while waiting for one of those, allocLock after
+    // sharesLock, and every one of them before the locks inside the FAT, the block cache and the allocator.
+    LockTable locks;
+
     Disk disk;
-    int16_t fat[FAT_SIZE];
+    Journal journal;
+    BlockCache cache;
+    Allocator allocator;
+    Fat fat;
+    AllocPolicy allocPolicy = CONTIGUOUS;
+
+    // Whether first_blk is extended with two bytes taken from file_name, set on volumes with 32-bit FAT entries
+    bool wideEntries = false;
+
+    // Whether directories may be stored as B-trees, set on volumes whose superblock is recent enough
+    bool treeDirs = false;
+
+    // Blocks freed by the running operations and by the operations in the running journal transaction, which may not
+    // be reused before the transaction is committed. allocLock also keeps reserve() and free() from interleaving.
+    std::mutex allocLock;
+    std::vector<int32_t> opFrees;
+    std::vector<int32_t> groupFrees;
+
+    // First blocks of removed directories, see releaseDirFrees()
+    std::vector<int32_t> dirFrees;
+
+    // Files sharing a chain besides the first one, keyed by the first block of the chain, the chain in each slot of
+    // the table, the blocks the table is stored in and the ones changed since it was last written. The table is kept
+    // packed so a change rewrites one or two of its blocks. Volumes without a superblock have nowhere to keep the
+    // table so cp copies the blocks there.
+    std::mutex sharesLock;
+    std::unordered_map<int32_t, Share> shares;
+    std::vector<int32_t> shareSlots;
+    std::vector<int32_t> sharesBlocks;
+    std::vector<bool> sharesDirty;
+    int32_t sharesStart = 0;
+    bool canShare = false;
+
+    // Tails of recently appended files keyed by the first block of the chain, and the first block of the files
+    // whose tails hold batched appends keyed by their last block. A tail in use by an operation is not dropped.
+    std::mutex tailLock;
+    std::unordered_map<int32_t, std::shared_ptr<Tail>> tails;
+    std::unordered_map<int32_t, int32_t> pendingTails;
+    bool batchAppends = false;
+
+    // Handles returned by open(), closed slots are reused
+    std::mutex handleLock;
+    std::vector<Handle> handles;
+
+    // Every CHAIN_SKIP-th block of recently sought file chains keyed by their first block, built as far as the
+    // chains have been followed
+    std::mutex chainLock;
+    std::unordered_map<int32_t, std::vector<int32_t>> chainIndexes;
+
+    // Name indexes of the directories that have been searched, keyed by the first block of the directory. The map is
+    // guarded by dirIndexLock, an index by the lock of its directory.
+    std::mutex dirIndexLock;
+    std::unordered_map<int32_t, DirIndex> dirIndexes;
+
+    // Resolved paths, dropped when a directory they went through changes
+    DentryCache dentries;
+
+    // The shared working path and the working paths of the sessions, closed slots are reused. pathLock guards the
+    // slots and the contents of every path.
+    mutable std::mutex pathLock;
     Path workingPath;
+    std::vector<std::unique_ptr<Path>> sessions;
 
-    /// @brief Reads a directory block from disk.
+    // The file system and session path the calling thread uses, see useSession()
+    static thread_local const FS* sessionFs;
+    static thread_local Path* sessionPath;
+
+    /// @brief Reads a directory block through the block cache.
     /// @param block FatIndex to read from.
     /// @param dirBlock Size FS::DIR_BLK_SIZE array of dir_entry to put read result in.
-    inline void read(const int16_t block, std::array<dir_entry, FS::DIR_BLK_SIZE>& dirBlock);
+    inline void read(const int32_t block, std::array<dir_entry, FS::DIR_BLK_SIZE>& dirBlock);
 
-    /// @brief Reads a file block from disk.
+    /// @brief Reads a file block through the block cache.
     /// @param block FatIndex to read from.
     /// @param dirBlock Size BLOCK_SIZE array of char to put read result in.
-    inline void read(const int16_t block, std::array<char, BLOCK_SIZE>& dirBlock);
-
-    /// @brief Reads fat from disk to memory.
-    inline void readFat();
-
-    /// @brief Writes a directory block to disk.
+    inline void read(const int32_t block, std::array<char, BLOCK_SIZE>& dirBlock);
+
+    /// @brief Reads one directory entry through the block cache.
+    /// @param block FatIndex of the directory block.
+    /// @param index Index of the entry in the block.
+    /// @return The entry, empty if the block can't be read.
+    inline dir_entry readEntry(const int32_t block, int index);
+
+    /// @brief Gives read access to a directory block without copying it.
+    /// @param block FatIndex to look at.
+    /// @param view Holds the block, which doesn't change for as long as it is kept.
+    /// @return FS::DIR_BLK_SIZE directory entries, empty if the block can't be read.
+    inline const std::array<dir_entry, FS::DIR_BLK_SIZE>& viewDir(const int32_t block, BlockCache::View& view);
+
+    /// @brief Gives read access to a file block without copying it.
+    /// @param block FatIndex to look at.
+    /// @param view Holds the block, which doesn't change for as long as it is kept.
+    /// @return BLOCK_SIZE bytes of data, zeros if the block can't be read.
+    inline const char* viewFile(const int32_t block, BlockCache::View& view);
+
+    /// @brief Reads many blocks with as few disk requests as possible.
+    /// @param blocks FatIndexes to read.
+    /// @param data Buffer of blocks.size() * BLOCK_SIZE bytes to put the blocks in, in the same order.
+    void readv(const std::vector<int32_t>& blocks, char* data);
+
+    /// @brief Writes many blocks with as few disk requests as possible.
+    /// @param blocks FatIndexes to write to.
+    /// @param data Buffer of blocks.size() * BLOCK_SIZE bytes to write, in the same order.
+    void writev(const std::vector<int32_t>& blocks, const char* data);
+
+    /// @brief Writes a directory block to the block cache.
     /// @param block FatIndex to write to.
     /// @param dirBlock Size FS::DIR_BLK_SIZE array of dir_entry to write to disk.
-    inline void write(const int16_t block, const std::array<dir_entry, FS::DIR_BLK_SIZE>& dirBlock);
+    inline void write(const int32_t block, const std::array<dir_entry, FS::DIR_BLK_SIZE>& dirBlock);
 
-    /// @brief Writes a file block to disk.
+    /// @brief Writes a file block to the block cache.
     /// @param block FatIndex to write to.
     /// @param dirBlock Size BLOCK_SIZE array of char to write to disk.
-    inline void write(const int16_t block, const std::array<char, BLOCK_SIZE>& dirBlock);
+    inline void write(const int32_t block, const std::array<char, BLOCK_SIZE>& dirBlock);
 
-    /// @brief Writes fat to disk.
+    /// @brief Writes the FAT blocks changed since the last call to the block cache, called by endOperation().
     inline void writeFat();
 
+    /// @brief Writes what the operation changed to the block cache and hands it to the disk or the journal.
+    /// @return 0 if succeeded else -1.
+    int endOperation();
+
+    /// @brief Commits the journal and gives the blocks freed by the group back to the allocator, called with no
+    /// other operation running.
+    void commitGroup();
+
+    /// @brief Checks that a directory still exists once its lock is held and rereads its entry from its "." entry,
+    /// since it may have been removed or changed since its path was resolved.
+    /// @param dir The directory, updated to the current entry.
+    /// @return True if the directory exists else false.
+    bool refreshDir(dir_entry& dir);
+
     /// @brief Returns whether dir entry is free or not by checking if file_name starts with NULL terminator.
     /// @param dir The directory entry to check.
     /// @return True if not free else false.
     inline static bool isNotFreeEntry(const dir_entry& dir);
 
-    /// @brief Return the Fat index to an empty file slot.
+    /// @brief Tells the dentry cache that entries in a directory were added, removed or changed.
+    /// @param dirBlock First block of the directory.
+    inline void dirChanged(int32_t dirBlock);
+
+    /// @brief Returns the name index of a directory, building it on first access.
+    /// addDirEntry() and removeDirEntry() keep it up to date.
+    /// @param dir The directory.
+    /// @return The index of the directory.
+    DirIndex& dirIndex(const dir_entry& dir);
+
+    /// @brief Finds where an entry is stored, through the name index of a linear directory or down the B-tree.
+    /// @param dir The directory.
+    /// @param name The name of the entry, at most 56 characters.
+    /// @param location Where the entry is stored.
+    /// @return True if found else false.
+    bool findEntry(const dir_entry& dir, const std::string& name, DirLocation& location);
+
+    /// @brief Checks whether a directory holds nothing besides "." and "..".
+    /// @param dir The directory.
+    /// @return True if empty else false.
+    bool dirEmpty(const dir_entry& dir);
+
+    /// @brief Turns a linear directory into a B-tree holding the same entries. The blocks of the directory after the
+    /// first are reused as nodes.
+    /// @param dir The directory.
+    /// @param index The index of the directory, which becomes the index of the B-tree.
+    /// @return True if succeeded else false if there is no room for the nodes, in which case nothing changed.
+    bool makeTree(const dir_entry& dir, DirIndex& index);
+
+    /// @brief Links new blocks to the end of the chain of a directory, nothing is linked unless all of them are found.
+    /// @param last The last block in the chain, moved to the new last block.
+    /// @param count Amount of blocks to link.
+    /// @param blocks The new blocks are added to the end of it.
+    /// @return True if succeeded else false.
+    bool extendDir(int32_t& last, size_t count, std::vector<int32_t>& blocks);
+
+    /// @brief Inserts an entry into a B-tree directory, splitting the nodes that are full on the way up.
+    /// @param dir The directory.
+    /// @param index The index of the directory.
+    /// @param entry The new entry, whose name isn't in the directory yet.
+    /// @return True if succeeded else false if there is no room for new nodes, in which case nothing changed.
+    bool treeInsert(const dir_entry& dir, DirIndex& index, const dir_entry& entry);
+
+    /// @brief Removes an entry from its leaf in a B-tree directory. Leaves that become empty are kept.
+    /// @param dir The directory.
+    /// @param index The index of the directory.
+    /// @param location Where the entry is stored.
+    void treeRemove(const dir_entry& dir, DirIndex& index, const DirLocation& location);
+
+    /// @brief Returns the name of a directory entry.
+    /// @param entry The directory entry.
+    /// @return The name, at most 56 characters.
+    inline static std::string entryName(const dir_entry& entry);
+
+    /// @brief Reads the superblock and mounts the FAT it describes, or the single FAT block of older volumes.
+    void mount();
+
+    /// @brief Reads the share table stored in the chain starting at sharesStart.
+    void loadShares();
+
+    /// @brief Makes sure the share table has room for count entries, allocating its chain on first use.
+    /// @param count Amount of entries.
+    /// @return True if succeeded else false.
+    bool growShares(size_t count);
+
+    /// @brief Writes the blocks of the share table that changed to the block cache, called by endOperation().
+    void writeShares();
+
+    /// @brief Counts one more file sharing a chain, the caller holds sharesLock and has grown the table.
+    /// @param first First block of the chain.
+    void addShare(int32_t first);
+
+    /// @brief Counts one file less sharing a chain, the last entry of the table fills the slot of a dropped one.
+    /// @param found The entry of the chain.
+    void dropShare(std::unordered_map<int32_t, Share>::iterator found);
+
+    /// @brief Returns the first block of a directory entry.
+    /// @param entry The directory entry.
+    /// @return Index in the FAT for the first block of the entry.
+    inline uint32_t firstBlk(const dir_entry& entry) const;
+
+    /// @brief Sets the first block of a directory entry.
+    /// @param entry The directory entry.
+    /// @param block Index in the FAT for the first block of the entry.
+    inline void setFirstBlk(dir_entry& entry, uint32_t block) const;
+
+    /// @return The longest file name the volume can store.
+    inline size_t maxNameLength() const;
+
+    /// @brief Sets the name of a directory entry without touching its first block.
+    /// @param entry The directory entry.
+    /// @param name The new name.
+    /// @return True if succeeded else false if the name is too long.
+    bool setName(dir_entry& entry, const std::string& name) const;
+
+    /// @brief Takes a free FAT entry and marks it as the end of a new chain.
+    /// @param hint Entry to place the new entry close to when the policy is CONTIGUOUS.
     /// @return Index or -1 if no empty slots.
-    int getEmptyFat() const;
+    int32_t allocFat(int32_t hint);
+
+    /// @brief Marks a single FAT entry as free.
+    /// @param index The FAT entry to free.
+    inline void releaseFat(int32_t index);
+
+    /// @brief Gives the blocks freed by committed operations back to the allocator.
+    void releaseFrees();
+
+    /// @brief Gives the first blocks of removed directories back unless a working path still goes through them, since
+    /// refreshDir() tells a directory only by the block it starts in. No operation may run meanwhile.
+    void releaseDirFrees();
+
+    /// @brief Commits the journal so that the blocks freed by earlier operations can be reused.
+    /// @return True if blocks were given back to the allocator else false.
+    bool commitFrees();
 
     /// @brief Reserves enough FAT blocks to fit size bytes.
     /// @param size Amount of bytes the FAT link should reserve.
+    /// @param hint FAT index the new blocks should be placed close to, usually the parent directory.
     /// @return -1 if failed else first node index in FAT.
-    int16_t reserve(size_t size);
+    int32_t reserve(size_t size, int32_t hint);
+
+    /// @brief Reserves blocks after the end of a chain and writes data to them.
+    /// @param first First block of the chain, set if the chain is empty.
+    /// @param last Last block of the chain or FAT_EOF if the chain is empty, moved to the new last block.
+    /// @param data count * BLOCK_SIZE bytes to write.
+    /// @param count Amount of blocks to add.
+    /// @param hint FAT index a new chain should be placed close to.
+    /// @return True if succeeded else false, in which case the chain is unchanged.
+    bool extendChain(int32_t& first, int32_t& last, const char* data, size_t count, int32_t hint);
+
+    /// @brief Copies the data of a chain to another chain of the same length.
+    /// @param src First block of the chain to copy.
+    /// @param dest First block of the chain to write.
+    void copyChain(int32_t src, int32_t dest);
+
+    /// @brief Gives a file a chain of its own before it is written in place, cloning the chain if it is shared.
+    /// @param first First block of the chain of the file.
+    /// @param size Size of the file.
+    /// @param hint FAT index the clone should be placed close to.
+    /// @return First block of the chain the file owns, or -1 if there is no room for the clone.
+    int32_t unshare(int32_t first, size_t size, int32_t hint);
+
+    /// @brief Drops the reference a removed file has to its chain, freeing the chain unless another file shares it.
+    /// @param first First block of the chain.
+    void dropChain(int32_t first);
+
+    /// @brief Collects the next blocks of a FAT chain.
+    /// @param fatIndex The block to start at, moved to the block after the last collected block.
+    /// @param count Maximum amount of blocks to collect.
+    /// @param blocks The collected blocks.
+    void collectChain(int32_t& fatIndex, size_t count, std::vector<int32_t>& blocks);
+
+    /// @brief Copies an open handle.
+    /// @param handle The handle.
+    /// @param mode Access the caller needs, which the handle must have been opened with.
+    /// @param open The handle.
+    /// @return True if the handle is open with that access else false.
+    bool getHandle(int handle, int mode, Handle& open);
+
+    /// @brief Finds the file an open handle refers to, the caller holds the lock of its directory.
+    /// @param open The handle.
+    /// @param file The directory entry of the file.
+    /// @param location Where the entry is stored.
+    /// @return True if found else false.
+    bool findHandle(const Handle& open, dir_entry& file, DirLocation& location);
+
+    /// @brief Writes a directory entry back to where it is stored, the rest of the directory block is kept so the
+    /// caller only needs the shared lock of the directory besides the lock of the entry's file.
+    /// @param dirBlock First block of the directory the entry is in.
+    /// @param location Where the entry is stored.
+    /// @param entry The new entry.
+    void writeEntry(int32_t dirBlock, const DirLocation& location, const dir_entry& entry);
+
+    /// @brief Makes sure a file doesn't share its chain before it is written in place, moving the entry to a clone
+    /// if it does.
+    /// @param file The directory entry of the file, updated to the clone.
+    /// @param dirBlock First block of the directory the entry is in.
+    /// @param location Where the entry is stored.
+    /// @return True if succeeded else false if there is no room for the clone.
+    bool ownChain(dir_entry& file, int32_t dirBlock, const DirLocation& location);
+
+    /// @brief Writes data into a file chain, growing it with zeros up to offset if offset is past its end. The size
+    /// in the entry is not changed.
+    /// @param file The directory entry of the file, which must own its chain.
+    /// @param data length bytes to write.
+    /// @param offset Where in the file to write.
+    /// @param length Amount of bytes to write.
+    /// @return True if succeeded else false if the chain couldn't grow, in which case it is unchanged.
+    bool writeRange(const dir_entry& file, const char* data, uint64_t offset, size_t length);
+
+    /// @brief Finds the block at a position in a chain, starting from the closest indexed block before it.
+    /// @param first First block of the chain.
+    /// @param index Position of the block in the chain.
+    /// @return The block or FAT_EOF if the chain is shorter.
+    int32_t seekChain(int32_t first, size_t index);
+
+    /// @brief Drops the indexed blocks past the end of a chain that was cut short.
+    /// @param first First block of the chain.
+    /// @param blocks Amount of blocks left in the chain.
+    void trimChainIndex(int32_t first, size_t blocks);
+
+    /// @brief Returns the tail of a file chain, finding it on first access.
+    /// @param first First block of the chain.
+    /// @param size Size of the file.
+    /// @return The tail, which is not dropped while it is held.
+    std::shared_ptr<Tail> tail(int32_t first, size_t size);
+
+    /// @brief Moves a tail to the new last block of its chain.
+    /// @param tail The tail, whose data already holds the new last block.
+    /// @param first First block of the chain.
+    /// @param lastBlock The new last block.
+    /// @param pending Whether the new last block is left unwritten.
+    void moveTail(Tail& tail, int32_t first, int32_t lastBlock, bool pending);
+
+    /// @brief Writes the last block of a chain if it holds batched appends, the caller holds tailLock.
+    /// @param tail The tail.
+    void writeTail(Tail& tail);
+
+    /// @brief Writes what batched appends have gathered in every tail.
+    /// @return 0 if succeeded else -1.
+    int writeTails();
 
     /// @brief Frees the linked lists FAT entries by setting them to FAT_FREE.
     /// @param fatStart The start of the FAT linked list.
-    void free(int16_t fatStart);
+    /// @param dir Whether the list is a removed directory, whose first block is kept back, see releaseDirFrees().
+    void free(int32_t fatStart, bool dir = false);
 
-    /// @brief Takes in a directory and a new entry and then sets the directory there.
+    /// @brief Takes in a directory and a new entry and then sets the directory there. A linear directory that grows
+    /// large is turned into a B-tree first.
     /// @param dir The directory to add an entry to.
     /// @param newEntry The new entry to be added.
     /// @return True if succeeded else false.
     bool addDirEntry(const dir_entry& dir, dir_entry newEntry);
 
-    /// @brief Removes entry by searching through the directory and then replaces it with the last entry.
+    /// @brief Removes entry by searching through the directory and then replaces it with the last entry, or takes it
+    /// out of its leaf if the directory is a B-tree.
     /// @param dir The directory to remove an entry in.
     /// @param fileName The file name of the file to be removed.
     /// @return True if succeeded else false.
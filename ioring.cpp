@@ -0,0 +1,177 @@
+#include "ioring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+// The C library has no wrappers for the io_uring system calls
+static int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+// Creates a closed ring
+IoRing::IoRing()
+    : fd(-1),
+      ringFd(-1),
+      depth(0),
+      sqRing(MAP_FAILED),
+      sqRingSize(0),
+      cqRing(MAP_FAILED),
+      cqRingSize(0),
+      sqes(MAP_FAILED),
+      sqesSize(0),
+      counters{} {}
+
+// Unmaps and closes the ring
+IoRing::~IoRing() { this->close(); }
+
+// Sets up a ring with depth entries and maps its submission and completion queues
+bool IoRing::open(int fd, unsigned depth) {
+    this->close();
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    this->ringFd = ioUringSetup(std::max(depth, 1u), &params);
+    if (this->ringFd < 0) {
+        this->ringFd = -1;
+        return false;
+    }
+    this->fd = fd;
+    this->depth = params.sq_entries;
+
+    // Newer kernels map both rings with one mmap
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+
+    this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd,
+                        IORING_OFF_SQ_RING);
+    if (this->sqRing == MAP_FAILED) {
+        this->close();
+        return false;
+    }
+    if (single) {
+        this->cqRing = this->sqRing;
+    } else {
+        this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            this->ringFd, IORING_OFF_CQ_RING);
+        if (this->cqRing == MAP_FAILED) {
+            this->close();
+            return false;
+        }
+    }
+    this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    this->sqes = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd,
+                      IORING_OFF_SQES);
+    if (this->sqes == MAP_FAILED) {
+        this->close();
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)this->sqRing;
+    uint8_t* cq = (uint8_t*)this->cqRing;
+    this->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    this->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    this->sqArray = (unsigned*)(sq + params.sq_off.array);
+    this->cqHead = (unsigned*)(cq + params.cq_off.head);
+    this->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    this->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    this->cqes = cq + params.cq_off.cqes;
+    return true;
+}
+
+// Unmaps the queues and closes the ring
+void IoRing::close() {
+    if (this->sqes != MAP_FAILED) munmap(this->sqes, this->sqesSize);
+    if (this->cqRing != MAP_FAILED && this->cqRing != this->sqRing) munmap(this->cqRing, this->cqRingSize);
+    if (this->sqRing != MAP_FAILED) munmap(this->sqRing, this->sqRingSize);
+    this->sqes = this->cqRing = this->sqRing = MAP_FAILED;
+    if (this->ringFd != -1) ::close(this->ringFd);
+    this->ringFd = -1;
+}
+
+// Submits the requests a window of up to depth at a time and reaps their completions, a linked window is one chain
+// that has to complete before the next window is submitted so the order holds across windows too
+size_t IoRing::run(const std::vector<Request>& requests, bool linked, std::vector<bool>& done) {
+    done.assign(requests.size(), false);
+    if (!this->enabled()) return requests.size();
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->counters.batches++;
+    size_t next = 0;
+    size_t completed = 0;
+    unsigned inFlight = 0;
+    unsigned unsubmitted = 0;
+    while (completed < requests.size()) {
+        // Fills the submission queue, a linked batch waits until the previous chain has completed
+        unsigned queued = 0;
+        unsigned tail = *this->sqTail;
+        io_uring_sqe* last = nullptr;
+        while (next < requests.size() && inFlight + queued < this->depth && (!linked || inFlight == 0)) {
+            const Request& request = requests[next];
+            unsigned index = tail & *this->sqMask;
+            io_uring_sqe* sqe = (io_uring_sqe*)this->sqes + index;
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = this->fd;
+            sqe->off = request.offset;
+            sqe->addr = (uint64_t)(uintptr_t)request.iov;
+            sqe->len = request.iovcnt;
+            sqe->user_data = next;
+            if (linked) sqe->flags = IOSQE_IO_LINK;
+            this->sqArray[index] = index;
+            last = sqe;
+            tail++;
+            queued++;
+            next++;
+        }
+        if (last) last->flags &= ~IOSQE_IO_LINK;
+        __atomic_store_n(this->sqTail, tail, __ATOMIC_RELEASE);
+
+        // Submits what was queued, along with whatever an earlier call left unsubmitted, and waits for at least one
+        // completion
+        unsubmitted += queued;
+        int ret;
+        do {
+            ret = ioUringEnter(this->ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+        } while (ret < 0 && errno == EINTR);
+        this->counters.enters++;
+        if (ret >= 0) unsubmitted -= std::min<unsigned>(ret, unsubmitted);
+        if (ret < 0) {
+            // The queued entries may never be consumed, so the ring can't be trusted anymore
+            this->close();
+            return requests.size() - std::count(done.begin(), done.end(), true);
+        }
+        this->counters.requests += queued;
+        inFlight += queued;
+        this->counters.maxInFlight = std::max<uint64_t>(this->counters.maxInFlight, inFlight);
+
+        unsigned reaped = this->reap(requests, done);
+        inFlight -= reaped;
+        completed += reaped;
+    }
+    return requests.size() - std::count(done.begin(), done.end(), true);
+}
+
+// Takes every completion posted so far, a request is done if it moved its whole length
+unsigned IoRing::reap(const std::vector<Request>& requests, std::vector<bool>& done) {
+    unsigned head = *this->cqHead;
+    unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+    unsigned reaped = 0;
+    for (; head != tail; head++, reaped++) {
+        const io_uring_cqe* cqe = (const io_uring_cqe*)this->cqes + (head & *this->cqMask);
+        size_t index = cqe->user_data;
+        if (index < requests.size()) done[index] = cqe->res >= 0 && size_t(cqe->res) == requests[index].length;
+    }
+    __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+}
@@ -0,0 +1,97 @@
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifndef __IORING_H__
+#define __IORING_H__
+
+/// @brief Minimal io_uring submission and completion ring set up with the raw system calls.
+/// A batch of reads or writes is submitted with as many requests in flight as the queue depth allows, which lets the
+/// kernel work on all of them at once instead of one system call at a time.
+class IoRing {
+   public:
+    /// @brief One vectored read or write.
+    struct Request {
+        bool write;          // pwritev if set, else preadv
+        uint64_t offset;     // byte offset in the file
+        const iovec* iov;    // buffers, which must stay valid until run() returns
+        unsigned iovcnt;     // amount of buffers
+        size_t length;       // total length of the buffers
+    };
+
+    /// @brief Counters describing how the ring was used.
+    struct Stats {
+        uint64_t batches;      // calls to run()
+        uint64_t requests;     // requests submitted
+        uint64_t enters;       // io_uring_enter system calls
+        uint64_t maxInFlight;  // most requests in flight at once
+    };
+
+    /// @brief Creates a closed ring, every request then fails.
+    IoRing();
+
+    /// @brief Unmaps and closes the ring.
+    ~IoRing();
+
+    /// @brief Sets the ring up for a file.
+    /// @param fd The file every request reads or writes.
+    /// @param depth Maximum amount of requests in flight.
+    /// @return True if io_uring is available else false, in which case the ring stays closed.
+    bool open(int fd, unsigned depth);
+
+    /// @brief Unmaps and closes the ring.
+    void close();
+
+    /// @return True if the ring is set up else false.
+    inline bool enabled() const { return this->ringFd != -1; }
+
+    /// @brief Runs a batch of requests, keeping up to the queue depth of them in flight.
+    /// @param requests The requests.
+    /// @param linked Whether every request starts only once the one before it has completed.
+    /// @param done Set for every request that transferred its whole length.
+    /// @return Amount of requests that didn't, the caller is expected to redo them.
+    size_t run(const std::vector<Request>& requests, bool linked, std::vector<bool>& done);
+
+    /// @return The usage counters.
+    inline const Stats& stats() const { return this->counters; }
+
+    /// @brief Sets every usage counter to zero.
+    inline void resetStats() { this->counters = Stats{}; }
+
+   private:
+    /// @brief Takes the completions the kernel has posted.
+    /// @param requests The requests of the running batch.
+    /// @param done Set for every request that transferred its whole length.
+    /// @return Amount of completions taken.
+    unsigned reap(const std::vector<Request>& requests, std::vector<bool>& done);
+
+    int fd;
+    int ringFd;
+    unsigned depth;
+
+    // Mapped submission ring, submission entries and completion ring
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    void* sqes;
+    size_t sqesSize;
+
+    // Pointers into the mapped rings
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    void* cqes;
+
+    Stats counters;
+
+    // The journal writes from its own thread while the file system reads
+    std::mutex lock;
+};
+
+#endif  // __IORING_H__
@@ -0,0 +1,341 @@
+#include "journal.h"
+
+#include <cstring>
+#include <vector>
+
+// Magic numbers of the journal header and of the first and last block of a transaction
+static const uint32_t JOURNAL_MAGIC = 0x4C4E524A;  // "JRNL"
+static const uint32_t TXN_MAGIC = 0x4E58544A;      // "JTXN"
+static const uint32_t COMMIT_MAGIC = 0x544D434A;   // "JCMT"
+
+// First block of the journal region
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t sequence;  // sequence number of the first transaction after the header
+};
+
+// Start of the descriptor of a transaction, followed by the home locations of its blocks
+struct TxnHeader {
+    uint32_t magic;
+    uint32_t count;  // amount of logged blocks
+    uint64_t sequence;
+};
+
+// Last block of a transaction, a transaction without it was never committed
+struct TxnCommit {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t sequence;
+    uint64_t checksum;  // FNV-1a of the descriptor and the logged blocks
+};
+
+// Amount of blocks needed for the descriptor of a transaction with count blocks
+static inline uint32_t descriptorBlocks(uint32_t count) {
+    return (sizeof(TxnHeader) + uint64_t(count) * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// FNV-1a hash, enough to tell a torn transaction from a committed one
+static uint64_t checksum(const uint8_t* data, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Binds the journal to a disk, the journal stays closed until open() or create()
+Journal::Journal(Disk* disk)
+    : disk(disk),
+      start(0),
+      size(0),
+      head(1),
+      sequence(1),
+      runningOps(0),
+      counters{},
+      requested(false),
+      checkpointing(false),
+      stopping(false) {}
+
+// Commits what is left and writes everything home
+Journal::~Journal() { this->close(); }
+
+// Replays the committed transactions in the region and starts over with an empty region
+int Journal::open(uint32_t start, uint32_t blocks) {
+    this->close();
+    if (blocks < 3) return -1;
+    this->start = start;
+    this->size = blocks;
+
+    int replayed = this->replay();
+    if (replayed == -1 || this->writeHeader()) {
+        this->size = 0;
+        return -1;
+    }
+    this->counters.replayed += replayed;
+    this->head = 1;
+    this->stopping = false;
+    this->worker = std::thread(&Journal::run, this);
+    return replayed;
+}
+
+// Starts an empty journal, the region is cleared since transactions of an earlier volume could otherwise follow the
+// new ones with the sequence numbers replay() expects
+int Journal::create(uint32_t start, uint32_t blocks) {
+    this->close();
+    if (blocks < 3) return -1;
+    this->start = start;
+    this->size = blocks;
+    this->sequence = 1;
+
+    std::vector<uint8_t> zeros(size_t(blocks - 1) * BLOCK_SIZE, 0);
+    if (this->disk->write_range(start + 1, blocks - 1, zeros.data()) || this->writeHeader()) {
+        this->size = 0;
+        return -1;
+    }
+    this->head = 1;
+    this->stopping = false;
+    this->worker = std::thread(&Journal::run, this);
+    return 0;
+}
+
+// Commits the running transaction, writes every committed block home and stops the background thread
+void Journal::close() {
+    if (!this->enabled()) return;
+    this->commit();
+    this->checkpoint();
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_one();
+    if (this->worker.joinable()) this->worker.join();
+    this->size = 0;
+}
+
+// Adds a block to the running transaction, a later copy of the same block replaces the earlier one
+void Journal::log(unsigned block_no, const uint8_t* blk) {
+    Image image = std::make_shared<std::array<uint8_t, BLOCK_SIZE>>();
+    std::memcpy(image->data(), blk, BLOCK_SIZE);
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->running.empty()) this->runningSince = std::chrono::steady_clock::now();
+    this->running[block_no] = image;
+}
+
+// Reads the newest copy of a block, the running transaction is newer than the committed ones
+bool Journal::read(unsigned block_no, uint8_t* blk) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto found = this->running.find(block_no);
+    if (found != this->running.end()) {
+        std::memcpy(blk, found->second->data(), BLOCK_SIZE);
+        return true;
+    }
+    auto done = this->committed.find(block_no);
+    if (done != this->committed.end()) {
+        std::memcpy(blk, done->second->data(), BLOCK_SIZE);
+        return true;
+    }
+    return false;
+}
+
+// Tells whether the home location of a block is older than the journal
+bool Journal::contains(unsigned block_no) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->running.count(block_no) || this->committed.count(block_no);
+}
+
+// Counts a finished operation, the group is due once it is large or old enough
+bool Journal::endOperation() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->running.empty()) return false;
+    this->runningOps++;
+    this->counters.operations++;
+    auto age = std::chrono::steady_clock::now() - this->runningSince;
+    return this->runningOps >= GROUP_COMMIT_OPS || this->running.size() >= GROUP_COMMIT_BLOCKS ||
+           age >= std::chrono::milliseconds(GROUP_COMMIT_MS);
+}
+
+// Appends the running transaction to the journal region with one write and syncs it
+int Journal::commit() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    if (!this->enabled() || this->running.empty()) return 0;
+
+    uint32_t count = this->running.size();
+    uint32_t descBlocks = descriptorBlocks(count);
+    uint64_t total = uint64_t(descBlocks) + count + 1;
+
+    // Makes room by writing the committed blocks home, a transaction too large for the whole region is written
+    // home directly without the protection of the journal
+    if (this->head + total > this->size) {
+        guard.unlock();
+        int ret = this->checkpoint();
+        guard.lock();
+        if (ret) return -1;
+    }
+    if (1 + total > this->size) {
+        std::vector<Disk::BlockIO> ios;
+        for (auto& block : this->running) ios.push_back(Disk::BlockIO{block.first, block.second->data()});
+        int ret = this->disk->writev(ios) || this->disk->sync() ? -1 : 0;
+        this->running.clear();
+        this->runningOps = 0;
+        return ret;
+    }
+
+    // Descriptor, then the blocks, then the commit block
+    std::vector<uint8_t> data(total * BLOCK_SIZE, 0);
+    TxnHeader header{TXN_MAGIC, count, this->sequence};
+    std::memcpy(data.data(), &header, sizeof(header));
+    size_t i = 0;
+    for (auto& block : this->running) {
+        uint32_t block_no = block.first;
+        std::memcpy(data.data() + sizeof(header) + i * sizeof(uint32_t), &block_no, sizeof(uint32_t));
+        std::memcpy(data.data() + (descBlocks + i) * BLOCK_SIZE, block.second->data(), BLOCK_SIZE);
+        i++;
+    }
+    TxnCommit footer{COMMIT_MAGIC, count, this->sequence, checksum(data.data(), (total - 1) * BLOCK_SIZE)};
+    std::memcpy(data.data() + (total - 1) * BLOCK_SIZE, &footer, sizeof(footer));
+
+    // The commit block is ordered after the rest, a torn transaction then never has one
+    std::vector<Disk::BlockIO> body(total - 1);
+    for (uint64_t b = 0; b + 1 < total; b++)
+        body[b] = Disk::BlockIO{unsigned(this->start + this->head + b), data.data() + b * BLOCK_SIZE};
+    std::vector<Disk::BlockIO> commitBlock{
+        Disk::BlockIO{unsigned(this->start + this->head + total - 1), data.data() + (total - 1) * BLOCK_SIZE}};
+    if (this->disk->write_ordered({body, commitBlock}) || this->disk->sync()) return -1;
+
+    // The committed blocks are now safe and wait for the background thread to write them home
+    for (auto& block : this->running) this->committed[block.first] = block.second;
+    this->running.clear();
+    this->runningOps = 0;
+    this->head += total;
+    this->sequence++;
+    this->counters.commits++;
+    this->counters.blocksLogged += total;
+
+    if (this->head > this->size / 2) {
+        this->requested = true;
+        this->wake.notify_one();
+    }
+    return 0;
+}
+
+// Writes every committed block home, waiting for the background thread if it is already doing so
+int Journal::checkpoint() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->idle.wait(guard, [this] { return !this->checkpointing; });
+    this->checkpointing = true;
+    guard.unlock();
+
+    int ret = this->writeBack();
+
+    guard.lock();
+    this->checkpointing = false;
+    this->idle.notify_all();
+    return ret;
+}
+
+// Writes the journal header and syncs it so that nothing is appended after a header that might get lost
+int Journal::writeHeader() {
+    std::array<uint8_t, BLOCK_SIZE> block{};
+    JournalHeader header{JOURNAL_MAGIC, 0, this->sequence};
+    std::memcpy(block.data(), &header, sizeof(header));
+    if (this->disk->write(this->start, block.data())) return -1;
+    return this->disk->sync();
+}
+
+// Writes home every transaction that follows the header with the expected sequence number and a valid commit block
+int Journal::replay() {
+    std::array<uint8_t, BLOCK_SIZE> block;
+    if (this->disk->read(this->start, block.data())) return -1;
+    JournalHeader header;
+    std::memcpy(&header, block.data(), sizeof(header));
+
+    // A region that was never written has nothing to replay
+    if (header.magic != JOURNAL_MAGIC) {
+        this->sequence = 1;
+        return 0;
+    }
+    this->sequence = header.sequence;
+
+    int replayed = 0;
+    uint32_t offset = 1;
+    std::vector<uint8_t> data;
+    while (offset < this->size) {
+        if (this->disk->read(this->start + offset, block.data())) break;
+        TxnHeader txn;
+        std::memcpy(&txn, block.data(), sizeof(txn));
+        if (txn.magic != TXN_MAGIC || txn.sequence != this->sequence) break;
+
+        uint32_t descBlocks = descriptorBlocks(txn.count);
+        uint64_t total = uint64_t(descBlocks) + txn.count + 1;
+        if (offset + total > this->size) break;
+        data.resize(total * BLOCK_SIZE);
+        if (this->disk->read_range(this->start + offset, total, data.data())) break;
+
+        TxnCommit footer;
+        std::memcpy(&footer, data.data() + (total - 1) * BLOCK_SIZE, sizeof(footer));
+        if (footer.magic != COMMIT_MAGIC || footer.sequence != txn.sequence || footer.count != txn.count ||
+            footer.checksum != checksum(data.data(), (total - 1) * BLOCK_SIZE))
+            break;
+
+        std::vector<Disk::BlockIO> ios(txn.count);
+        for (uint32_t i = 0; i < txn.count; i++) {
+            uint32_t block_no;
+            std::memcpy(&block_no, data.data() + sizeof(txn) + i * sizeof(uint32_t), sizeof(uint32_t));
+            ios[i] = Disk::BlockIO{block_no, data.data() + (descBlocks + i) * BLOCK_SIZE};
+        }
+        if (this->disk->writev(ios)) return -1;
+
+        offset += total;
+        this->sequence++;
+        replayed++;
+    }
+    if (this->disk->sync()) return -1;
+    return replayed;
+}
+
+// Writes a snapshot of the committed blocks home, the region is emptied only if no commit happened meanwhile
+int Journal::writeBack() {
+    std::vector<std::pair<unsigned, Image>> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        snapshot.assign(this->committed.begin(), this->committed.end());
+    }
+
+    std::vector<Disk::BlockIO> ios;
+    for (auto& block : snapshot) ios.push_back(Disk::BlockIO{block.first, block.second->data()});
+    if (!ios.empty() && (this->disk->writev(ios) || this->disk->sync())) return -1;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    for (auto& block : snapshot) {
+        auto found = this->committed.find(block.first);
+        if (found != this->committed.end() && found->second == block.second) this->committed.erase(found);
+    }
+    if (!this->committed.empty() || this->head == 1) return 0;
+
+    // Every transaction in the region is home, so the next one can start over at the beginning
+    if (this->writeHeader()) return -1;
+    this->head = 1;
+    this->counters.checkpoints++;
+    return 0;
+}
+
+// Runs checkpoints in the background whenever commit() finds the region half full
+void Journal::run() {
+    std::unique_lock<std::mutex> guard(this->lock);
+    while (true) {
+        this->wake.wait(guard, [this] { return this->stopping || this->requested; });
+        if (this->stopping) return;
+        this->requested = false;
+        if (this->checkpointing) continue;
+
+        this->checkpointing = true;
+        guard.unlock();
+        this->writeBack();
+        guard.lock();
+        this->checkpointing = false;
+        this->idle.notify_all();
+    }
+}
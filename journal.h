@@ -0,0 +1,142 @@
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "disk.h"
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+// A group of operations is committed once it holds this many operations or blocks, or is this old
+#define GROUP_COMMIT_OPS 16
+#define GROUP_COMMIT_BLOCKS 256
+#define GROUP_COMMIT_MS 50
+
+/// @brief Write-ahead journal for metadata blocks, kept in a region of the disk.
+/// Blocks written by finished operations are gathered in a running transaction that is appended to the region with
+/// one sequential write once enough operations have been gathered. A background thread later writes the committed
+/// blocks to their home locations and empties the region. Committed transactions that were not written home
+/// before a crash are replayed when the journal is opened.
+class Journal {
+   public:
+    /// @brief Counters describing the work done by the journal.
+    struct Stats {
+        uint64_t operations;    // operations that logged at least one block
+        uint64_t commits;       // transactions appended to the journal region
+        uint64_t blocksLogged;  // blocks written to the journal region
+        uint64_t checkpoints;   // times the journal region was emptied
+        uint64_t replayed;      // transactions replayed when the journal was opened
+    };
+
+    /// @brief Binds the journal to a disk, nothing is journaled until the journal is opened.
+    /// @param disk The disk holding the journal region and the home locations of the blocks.
+    Journal(Disk* disk);
+
+    /// @brief Commits what is left and writes everything home.
+    ~Journal();
+
+    /// @brief Opens an existing journal region, replaying the transactions committed in it.
+    /// @param start First block of the journal region.
+    /// @param blocks Amount of blocks in the journal region.
+    /// @return Amount of replayed transactions, or -1 on failure in which case the journal stays closed.
+    int open(uint32_t start, uint32_t blocks);
+
+    /// @brief Starts an empty journal in a region, whatever the region held before is cleared.
+    /// @param start First block of the journal region.
+    /// @param blocks Amount of blocks in the journal region.
+    /// @return 0 if succeeded else -1.
+    int create(uint32_t start, uint32_t blocks);
+
+    /// @brief Commits the running transaction, writes every committed block home and stops the background thread.
+    void close();
+
+    /// @return True if the journal is open else false.
+    inline bool enabled() const { return this->size != 0; }
+
+    /// @brief Adds a block to the running transaction, replacing any earlier copy of it.
+    /// @param block_no Home location of the block.
+    /// @param blk BLOCK_SIZE buffer to log.
+    void log(unsigned block_no, const uint8_t* blk);
+
+    /// @brief Reads the newest logged copy of a block.
+    /// @param block_no Home location of the block.
+    /// @param blk BLOCK_SIZE buffer to put the block in.
+    /// @return True if the journal has a copy of the block else false, in which case the disk is up to date.
+    bool read(unsigned block_no, uint8_t* blk);
+
+    /// @return True if the journal has a copy of the block that is not written home yet.
+    bool contains(unsigned block_no);
+
+    /// @brief Ends an operation whose blocks have been logged. The caller commits the group once it is due, at a
+    /// point where no other operation is half done.
+    /// @return True if the group is due to be committed else false.
+    bool endOperation();
+
+    /// @brief Appends the running transaction to the journal region and syncs it.
+    /// @return 0 if succeeded else -1.
+    int commit();
+
+    /// @brief Writes every committed block home and empties the journal region, waiting for the background thread.
+    /// @return 0 if succeeded else -1.
+    int checkpoint();
+
+    /// @return The journal counters.
+    inline const Stats& stats() const { return this->counters; }
+
+    /// @brief Sets every journal counter to zero.
+    inline void resetStats() { this->counters = Stats{}; }
+
+   private:
+    typedef std::shared_ptr<std::array<uint8_t, BLOCK_SIZE>> Image;
+
+    /// @brief Writes the journal header, which tells replay() the sequence number of the first transaction.
+    /// @return 0 if succeeded else -1.
+    int writeHeader();
+
+    /// @brief Replays the committed transactions at the start of the journal region.
+    /// @return Amount of replayed transactions, or -1 on failure.
+    int replay();
+
+    /// @brief Writes the committed blocks home, emptying the journal region if nothing was committed meanwhile.
+    /// The caller must have set checkpointing.
+    /// @return 0 if succeeded else -1.
+    int writeBack();
+
+    /// @brief Body of the background thread, runs writeBack() whenever the journal region is half full.
+    void run();
+
+    Disk* disk;
+    uint32_t start;
+    uint32_t size;
+
+    // Next free block in the journal region and sequence number of the next transaction
+    uint32_t head;
+    uint64_t sequence;
+
+    // Blocks of finished operations that are not committed yet, in block order
+    std::map<unsigned, Image> running;
+    uint64_t runningOps;
+    std::chrono::steady_clock::time_point runningSince;
+
+    // Committed blocks that have not been written home yet
+    std::unordered_map<unsigned, Image> committed;
+
+    Stats counters;
+
+    // Guards everything above against the background thread
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool requested;
+    bool checkpointing;
+    bool stopping;
+    std::thread worker;
+};
+
+#endif  // __JOURNAL_H__
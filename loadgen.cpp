@@ -0,0 +1,158 @@
+// Load generator for filesystem --server: every client connects its own session, works in a directory of its own
+// and times each command from sending it until the next prompt arrives. Prints latency percentiles per command and
+// the total amount of commands per second.
+//
+// Usage: loadgen <socket> [clients] [rounds] [filesize]
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What the server prints when it is ready for the next command
+static const std::string PROMPT = "filesystem> ";
+
+typedef std::chrono::steady_clock Clock;
+
+/// @brief One connected session and the latencies of the commands it ran.
+struct Client {
+    int fd = -1;
+    std::string pending;                                 // received output not consumed yet
+    std::map<std::string, std::vector<double>> latency;  // microseconds per command name
+    size_t errors = 0;                                   // commands that answered with an error
+};
+
+// Connects to the server, -1 if it isn't there
+static int connectTo(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return -1;
+    path.copy(address.sun_path, path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (sockaddr*)&address, sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads until the output ends with a prompt and returns what came before it
+static bool waitPrompt(Client& client, std::string& output) {
+    char buffer[65536];
+    while (client.pending.size() < PROMPT.size() ||
+           client.pending.compare(client.pending.size() - PROMPT.size(), PROMPT.size(), PROMPT) != 0) {
+        ssize_t got = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (got <= 0) return false;
+        client.pending.append(buffer, got);
+    }
+    output = client.pending.substr(0, client.pending.size() - PROMPT.size());
+    client.pending.clear();
+    return true;
+}
+
+// Sends a command, with the rows of create if there are any, and times it until the next prompt
+static bool run(Client& client, const std::string& name, const std::string& request) {
+    auto start = Clock::now();
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(client.fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    std::string output;
+    if (!waitPrompt(client, output)) return false;
+    client.latency[name].push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    if (output.find("Error:") != std::string::npos) client.errors++;
+    return true;
+}
+
+// Runs rounds of commands touching every operation in a directory of its own
+static void work(Client& client, int id, int rounds, const std::string& data) {
+    std::string output;
+    if (!waitPrompt(client, output)) return;
+    std::string dir = "load" + std::to_string(id);
+    run(client, "mkdir", "mkdir " + dir + "\n");
+    run(client, "cd", "cd " + dir + "\n");
+    for (int i = 0; i < rounds; i++) {
+        if (!run(client, "create", "create f\n" + data + "\n") || !run(client, "cat", "cat f\n") ||
+            !run(client, "ls", "ls\n") || !run(client, "cp", "cp f g\n") || !run(client, "append", "append f g\n") ||
+            !run(client, "mv", "mv g h\n") || !run(client, "chmod", "chmod 6 h\n") ||
+            !run(client, "read", "read h 0 64\n") || !run(client, "rm", "rm h\n") || !run(client, "rm", "rm f\n") ||
+            !run(client, "pwd", "pwd\n"))
+            return;
+    }
+    run(client, "cd", "cd ..\n");
+    run(client, "quit", "quit\n");
+}
+
+// Returns the value below which a share of the sorted values lie
+static double percentile(const std::vector<double>& sorted, double share) {
+    size_t index = std::min(sorted.size() - 1, size_t(share * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: loadgen <socket> [clients] [rounds] [filesize]\n";
+        return 1;
+    }
+    std::string path = argv[1];
+    int clients = argc > 2 ? std::atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 1000;
+    size_t filesize = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 1000;
+
+    // The file data is rows of 63 characters, create ends the file at the first empty row
+    std::string data;
+    while (data.size() < filesize) data += std::string(std::min<size_t>(63, filesize - data.size()), 'x') + "\n";
+
+    std::vector<Client> sessions(clients);
+    for (Client& client : sessions) {
+        client.fd = connectTo(path);
+        if (client.fd == -1) {
+            std::cerr << "Can't connect to " << path << "\n";
+            return 1;
+        }
+    }
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) threads.emplace_back(work, std::ref(sessions[i]), i, rounds, std::cref(data));
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Merges the latencies of every client per command
+    std::map<std::string, std::vector<double>> latency;
+    size_t total = 0;
+    size_t errors = 0;
+    for (Client& client : sessions) {
+        for (auto& command : client.latency) {
+            std::vector<double>& all = latency[command.first];
+            all.insert(all.end(), command.second.begin(), command.second.end());
+            total += command.second.size();
+        }
+        errors += client.errors;
+        close(client.fd);
+    }
+
+    std::printf("%-8s %10s %10s %10s %10s %10s\n", "command", "count", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (auto& command : latency) {
+        std::vector<double>& sorted = command.second;
+        std::sort(sorted.begin(), sorted.end());
+        std::printf("%-8s %10zu %10.1f %10.1f %10.1f %10.1f\n", command.first.c_str(), sorted.size(),
+                    percentile(sorted, 0.50), percentile(sorted, 0.90), percentile(sorted, 0.99), sorted.back());
+    }
+    std::printf("%zu commands from %d clients in %.3f s, %.0f ops/sec, %zu errors\n", total, clients, seconds,
+                total / seconds, errors);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "locks.h"
+
+#include <stdexcept>
+
+// Takes one lock, the entry is created with writer preference the first time the key is used
+void LockTable::lock(const Key& key, bool exclusive) {
+    Entry* entry;
+    {
+        std::lock_guard<std::mutex> guard(this->tableLock);
+        auto found = this->entries.find(key);
+        if (found == this->entries.end()) {
+            found = this->entries.emplace(key, Entry{}).first;
+            pthread_rwlockattr_t attr;
+            pthread_rwlockattr_init(&attr);
+            pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+            pthread_rwlock_init(&found->second.lock, &attr);
+            pthread_rwlockattr_destroy(&attr);
+        }
+        entry = &found->second;
+        entry->users++;
+    }
+
+    // Map nodes don't move, so the entry stays put while the table lock is released
+    int ret = exclusive ? pthread_rwlock_wrlock(&entry->lock) : pthread_rwlock_rdlock(&entry->lock);
+    if (ret) throw std::runtime_error("LockTable::lock() failed to take a lock!");
+}
+
+// Releases one lock and drops its entry when it was the last user
+void LockTable::unlock(const Key& key) {
+    std::lock_guard<std::mutex> guard(this->tableLock);
+    auto found = this->entries.find(key);
+    if (found == this->entries.end()) throw std::runtime_error("LockTable::unlock() on a lock that is not held!");
+    pthread_rwlock_unlock(&found->second.lock);
+    if (--found->second.users > 0) return;
+    pthread_rwlock_destroy(&found->second.lock);
+    this->entries.erase(found);
+}
+
+// Creates an empty set
+LockTable::Set::Set(LockTable* table) : table(table), locked(false) {}
+
+// Releases whatever is still held
+LockTable::Set::~Set() { this->unlock(); }
+
+// Remembers a lock to take, writing wins over reading when a key is added twice
+void LockTable::Set::add(int32_t dir, const std::string& name, bool exclusive) {
+    bool& wanted = this->wanted[Key(dir, name)];
+    wanted = wanted || exclusive;
+}
+
+// Takes the locks in key order
+void LockTable::Set::lock() {
+    for (auto& key : this->wanted) this->table->lock(key.first, key.second);
+    this->locked = true;
+}
+
+// Releases one lock and forgets it
+void LockTable::Set::unlock(int32_t dir, const std::string& name) {
+    auto found = this->wanted.find(Key(dir, name));
+    if (found == this->wanted.end()) return;
+    if (this->locked) this->table->unlock(found->first);
+    this->wanted.erase(found);
+}
+
+// Releases every lock in reverse order
+void LockTable::Set::unlock() {
+    if (this->locked) {
+        for (auto it = this->wanted.rbegin(); it != this->wanted.rend(); it++) this->table->unlock(it->first);
+    }
+    this->wanted.clear();
+    this->locked = false;
+}
@@ -0,0 +1,84 @@
+#include <pthread.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#ifndef __LOCKS_H__
+#define __LOCKS_H__
+
+/// @brief Reader/writer locks of the directories and files of the file system, keyed by the first block of a
+/// directory and a name in it, the empty name standing for the directory itself.
+/// A lock only exists while it is held or waited for, and writers are preferred so they are not starved by readers.
+class LockTable {
+   public:
+    typedef std::pair<int32_t, std::string> Key;
+
+    /// @brief The locks one operation holds. They are taken together in key order, which puts a directory before
+    /// the files in it, so two operations never wait for each other. Every lock is released when the set goes out of
+    /// scope.
+    class Set {
+       public:
+        /// @brief Creates an empty set.
+        /// @param table The table the locks are taken from.
+        Set(LockTable* table);
+
+        /// @brief Releases every lock that is still held.
+        ~Set();
+
+        Set(const Set&) = delete;
+        Set& operator=(const Set&) = delete;
+
+        /// @brief Adds a lock to take, a key added twice is taken exclusively if either asked for it.
+        /// @param dir First block of the directory.
+        /// @param name Name of a file in the directory, or empty for the directory itself.
+        /// @param exclusive Whether to take the lock for writing.
+        void add(int32_t dir, const std::string& name, bool exclusive);
+
+        /// @brief Takes every added lock in key order.
+        void lock();
+
+        /// @brief Releases one lock before the others.
+        /// @param dir First block of the directory.
+        /// @param name Name of a file in the directory, or empty for the directory itself.
+        void unlock(int32_t dir, const std::string& name);
+
+        /// @brief Releases every lock that is still held.
+        void unlock();
+
+       private:
+        LockTable* table;
+
+        // Whether each key is wanted for writing, the map keeps the keys in the order they are taken
+        std::map<Key, bool> wanted;
+        bool locked;
+    };
+
+    LockTable() = default;
+    LockTable(const LockTable&) = delete;
+    LockTable& operator=(const LockTable&) = delete;
+
+    /// @brief Takes one lock, creating it on first use.
+    /// @param key The directory and name.
+    /// @param exclusive Whether to take the lock for writing.
+    void lock(const Key& key, bool exclusive);
+
+    /// @brief Releases one lock, dropping it once nobody holds or waits for it.
+    /// @param key The directory and name.
+    void unlock(const Key& key);
+
+   private:
+    /// @brief One lock and the amount of threads holding or waiting for it.
+    struct Entry {
+        pthread_rwlock_t lock;
+        unsigned users;
+    };
+
+    // Guards the map, never held while waiting for an entry
+    std::mutex tableLock;
+    std::map<Key, Entry> entries;
+};
+
+#endif  // __LOCKS_H__
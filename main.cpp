@@ -1,8 +1,58 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
 #include "disk.h"
 #include "fs.h"
+#include "server.h"
+#include "session.h"
 #include "shell.h"
+#include "trace.h"
 
 int main(int argc, char **argv) {
+    // filesystem --trace <file> [...] records every command of every session
+    // to a binary trace that replay can run again, before the usual options
+    TraceWriter trace;
+    if (argc >= 3 && std::string(argv[1]) == "--trace") {
+        if (trace.open(argv[2])) {
+            std::cerr << "Error: cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+        Session::trace = &trace;
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    // filesystem --server <socket> serves many sessions over a Unix domain
+    // socket instead of one on stdin/stdout
+    if (argc == 3 && std::string(argv[1]) == "--server") {
+        FS filesystem;
+        Server server(filesystem, argv[2]);
+        return server.run() ? 1 : 0;
+    }
+
+    // filesystem --batch [script] runs the commands in script, or on stdin,
+    // without prompts and with the output buffered
+    if ((argc == 2 || argc == 3) && std::string(argv[1]) == "--batch") {
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(nullptr);
+        std::ifstream script;
+        if (argc == 3) {
+            script.open(argv[2]);
+            if (!script) {
+                std::cerr << "Error: cannot open " << argv[2] << std::endl;
+                return 1;
+            }
+        }
+        FS filesystem;
+        Session session(filesystem, argc == 3 ? script : std::cin, std::cout, STDOUT_FILENO, true);
+        session.run();
+        std::cout.flush();
+        return 0;
+    }
+
     Shell shell;
     shell.run();
     return 0;
@@ -0,0 +1,205 @@
+// Replays a trace recorded with filesystem --trace against a fresh disk image in a scratch directory. Commands run one
+// at a time in the order they were recorded, each in a file system session standing for the session that ran it, so
+// working directories follow the original ones. By default every command starts as soon as the one before it ended,
+// with --timing original each one waits until the time it started at in the trace. Prints latency percentiles per
+// command and the total amount of commands per second.
+//
+// Usage: replay <trace> [--timing fast|original] [--backend pread|mmap|uring]
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "disk.h"
+#include "fs.h"
+#include "trace.h"
+
+typedef std::chrono::steady_clock Clock;
+
+/// @brief Reads straight from a buffer without copying it.
+class MemoryBuf : public std::streambuf {
+   public:
+    MemoryBuf(const char* data, size_t size) {
+        char* start = const_cast<char*>(data);
+        this->setg(start, start, start + size);
+    }
+};
+
+/// @brief Throws away everything written to it.
+class NullBuf : public std::streambuf {
+   protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+/// @brief Runs the commands of a trace on one file system.
+class Replayer {
+   public:
+    Replayer(FS& fs) : fs(fs), devNull(open("/dev/null", O_WRONLY)), discard(), out(&discard) {}
+    ~Replayer() { close(this->devNull); }
+
+    /// @brief Runs one command the way the shell would.
+    /// @return 0 if succeeded, -1 if it failed and 1 if the command isn't replayed.
+    int run(const TraceRecord& record) {
+        this->use(record.session);
+        const std::string& command = record.command;
+        const std::vector<std::string>& args = record.args;
+        size_t count = args.size();
+        if (command == "format" && count == 0) return this->fs.format();
+        if (command == "format" && count == 2)
+            return this->fs.format(std::strtoul(args[0].c_str(), nullptr, 10), std::atoi(args[1].c_str()));
+        if (command == "create" && count >= 1) {
+            // The data of the trace is gone, only its size is replayed
+            if (this->data.size() < record.dataSize) this->data.resize(record.dataSize, 'x');
+            MemoryBuf buffer(this->data.data(), record.dataSize);
+            std::istream input(&buffer);
+            return this->fs.create(args[0], input, true);
+        }
+        if (command == "cat" && count == 1) return this->fs.cat(args[0], this->devNull);
+        if (command == "ls" && count == 0) return this->fs.ls(this->out);
+        if (command == "cp" && count == 2) return this->fs.cp(args[0], args[1]);
+        if (command == "mv" && count == 2) return this->fs.mv(args[0], args[1]);
+        if (command == "rm" && count == 1) return this->fs.rm(args[0]);
+        if (command == "append" && count == 2) return this->fs.append(args[0], args[1]);
+        if (command == "mkdir" && count == 1) return this->fs.mkdir(args[0]);
+        if (command == "mkdir" && count == 2 && args[0] == "-b") return this->fs.mkdir(args[1], FS::BTREE);
+        if (command == "cd" && count == 1) return this->fs.cd(args[0]);
+        if (command == "pwd" && count == 0) return this->fs.pwd(this->out);
+        if (command == "chmod" && count == 2) return this->fs.chmod(args[0], args[1]);
+        if (command == "read" && count == 3) return this->read(args[0], std::strtoull(args[1].c_str(), nullptr, 10),
+                                                               std::strtoull(args[2].c_str(), nullptr, 10));
+        return 1;
+    }
+
+   private:
+    // Opens a file system session the first time a recorded session shows up
+    void use(uint32_t session) {
+        auto found = this->sessions.find(session);
+        if (found == this->sessions.end()) found = this->sessions.emplace(session, this->fs.openSession()).first;
+        this->fs.useSession(found->second);
+    }
+
+    // Reads a range through a handle like the read command does
+    int read(const std::string& path, uint64_t offset, uint64_t left) {
+        int handle = this->fs.open(path, READ);
+        if (handle < 0) return -1;
+        int ret = 0;
+        std::vector<char> chunk(BLOCK_SIZE * 16);
+        while (left > 0) {
+            int64_t got = this->fs.pread(handle, chunk.data(), std::min<uint64_t>(left, chunk.size()), offset);
+            if (got <= 0) {
+                if (got < 0) ret = -1;
+                break;
+            }
+            offset += got;
+            left -= got;
+        }
+        this->fs.close(handle);
+        return ret;
+    }
+
+    FS& fs;
+    int devNull;
+    NullBuf discard;
+    std::ostream out;
+    std::vector<char> data;
+    std::map<uint32_t, int> sessions;
+};
+
+// Returns the value below which a share of the sorted values lie
+static double percentile(const std::vector<double>& sorted, double share) {
+    size_t index = std::min(sorted.size() - 1, size_t(share * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: replay <trace> [--timing fast|original] [--backend pread|mmap|uring]\n";
+        return 1;
+    }
+    std::string tracePath = argv[1];
+    bool original = false;
+    Disk::Backend backend = Disk::MMAP;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--timing" && (value == "fast" || value == "original"))
+            original = value == "original";
+        else if (arg == "--backend" && (value == "pread" || value == "mmap" || value == "uring"))
+            backend = value == "pread" ? Disk::PREAD : value == "mmap" ? Disk::MMAP : Disk::URING;
+        else {
+            std::cerr << "Usage: replay <trace> [--timing fast|original] [--backend pread|mmap|uring]\n";
+            return 1;
+        }
+        i++;
+    }
+
+    // The trace is opened before leaving the working directory it may be relative to
+    TraceReader reader;
+    if (reader.open(tracePath)) {
+        std::cerr << "Can't read trace " << tracePath << "\n";
+        return 1;
+    }
+    char scratch[] = "/tmp/fsreplay.XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch)) {
+        std::cerr << "Can't make a scratch directory\n";
+        return 1;
+    }
+    {
+        std::ofstream disk(DISKNAME, std::ios::binary);
+        disk.seekp((uint64_t)DEFAULT_NO_BLOCKS * BLOCK_SIZE - 1);
+        disk.write("", 1);
+    }
+
+    std::map<std::string, std::vector<double>> latency;
+    size_t total = 0;
+    size_t errors = 0;
+    size_t skipped = 0;
+    double seconds = 0;
+    {
+        FS fs(backend);
+        fs.format();
+        Replayer replayer(fs);
+        TraceRecord record;
+        auto start = Clock::now();
+        while (reader.next(record)) {
+            if (original) std::this_thread::sleep_until(start + std::chrono::microseconds(record.micros));
+            auto begin = Clock::now();
+            int ret = replayer.run(record);
+            double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+            if (ret == 1) {
+                skipped++;
+                continue;
+            }
+            latency[record.command].push_back(elapsed);
+            total++;
+            if (ret) errors++;
+        }
+        fs.useSession(-1);
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    unlink(DISKNAME);
+    if (chdir("/") == 0) rmdir(scratch);
+
+    std::printf("%-8s %10s %10s %10s %10s %10s\n", "command", "count", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (auto& command : latency) {
+        std::vector<double>& sorted = command.second;
+        std::sort(sorted.begin(), sorted.end());
+        std::printf("%-8s %10zu %10.1f %10.1f %10.1f %10.1f\n", command.first.c_str(), sorted.size(),
+                    percentile(sorted, 0.50), percentile(sorted, 0.90), percentile(sorted, 0.99), sorted.back());
+    }
+    std::printf("%zu commands in %.3f s, %.0f ops/sec, %zu errors, %zu not replayed\n", total, seconds,
+                seconds > 0 ? total / seconds : 0.0, errors, skipped);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+
+#include "session.h"
+
+// Sessions the kernel queues before they are accepted
+static const int LISTEN_BACKLOG = 128;
+
+// How often finished sessions are joined while no client connects
+static const int REAP_INTERVAL_MS = 1000;
+
+// Written to by the signal handler to wake the accepting thread, whichever thread the signal is delivered to
+static int stopPipe[2] = {-1, -1};
+
+// Asks the server to stop
+static void requestStop(int) {
+    char byte = 0;
+    ssize_t ignored = write(stopPipe[1], &byte, 1);
+    (void)ignored;
+}
+
+/// @brief Buffered stream over a connected socket, reads come in as they arrive and writes go out on flush.
+class SocketBuf : public std::streambuf {
+   public:
+    explicit SocketBuf(int fd) : fd(fd) {
+        this->setg(this->input, this->input, this->input);
+        this->setp(this->output, this->output + sizeof(this->output));
+    }
+
+   protected:
+    // Waits for more input, the end of the stream is reached when the client is gone
+    int underflow() override {
+        ssize_t got;
+        do {
+            got = recv(this->fd, this->input, sizeof(this->input), 0);
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0) return traits_type::eof();
+        this->setg(this->input, this->input, this->input + got);
+        return traits_type::to_int_type(*this->gptr());
+    }
+
+    // Sends the full output buffer to make room for one more character
+    int overflow(int c) override {
+        if (this->sync()) return traits_type::eof();
+        if (c != traits_type::eof()) {
+            *this->pptr() = c;
+            this->pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    // Sends whatever is buffered, a client that is gone only makes the send fail
+    int sync() override {
+        const char* data = this->pbase();
+        size_t left = this->pptr() - this->pbase();
+        this->setp(this->output, this->output + sizeof(this->output));
+        while (left > 0) {
+            ssize_t sent = send(this->fd, data, left, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return -1;
+            data += sent;
+            left -= sent;
+        }
+        return 0;
+    }
+
+   private:
+    int fd;
+    char input[BLOCK_SIZE];
+    char output[BLOCK_SIZE];
+};
+
+// Binds the server to a file system
+Server::Server(FS& filesystem, const std::string& socketPath)
+    : filesystem(filesystem), socketPath(socketPath), listenFd(-1) {}
+
+// Ends every session and removes the socket
+Server::~Server() {
+    this->reap(true);
+    if (this->listenFd == -1) return;
+    close(this->listenFd);
+    unlink(this->socketPath.c_str());
+}
+
+// Listens on the socket and starts a session for every client until a signal asks the server to stop
+int Server::run() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (this->socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Server::run - ERROR: Socket path too long (" << this->socketPath << ")\n";
+        return -1;
+    }
+    this->socketPath.copy(address.sun_path, this->socketPath.size());
+
+    unlink(this->socketPath.c_str());
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((stopPipe[0] == -1 && pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK)) || this->listenFd == -1 ||
+        bind(this->listenFd, (sockaddr*)&address, sizeof(address)) || listen(this->listenFd, LISTEN_BACKLOG)) {
+        std::cerr << "Server::run - ERROR: Can't listen on " << this->socketPath << " (" << strerror(errno) << ")\n";
+        return -1;
+    }
+
+    // The handler only wakes the loop below, the sessions are ended from here
+    struct sigaction stop {};
+    stop.sa_handler = requestStop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+
+    // cat writes straight to the socket, a client that hangs up must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Listening on " << this->socketPath << std::endl;
+
+    pollfd fds[2] = {{this->listenFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+    while (true) {
+        int ready = poll(fds, 2, REAP_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (fds[1].revents & POLLIN) break;
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            int fd = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd != -1) {
+                this->connections.emplace_back();
+                Connection& connection = this->connections.back();
+                connection.fd = fd;
+                connection.done = false;
+                connection.thread = std::thread(&Server::serve, this, std::ref(connection));
+            }
+        }
+        this->reap(false);
+    }
+
+    std::cout << "Stopping server...\n";
+    return 0;
+}
+
+// Runs the commands of one client from its own working directory
+void Server::serve(Connection& connection) {
+    SocketBuf buffer(connection.fd);
+    std::istream in(&buffer);
+    std::ostream out(&buffer);
+    in.tie(&out);
+
+    int session = this->filesystem.openSession();
+    this->filesystem.useSession(session);
+    Session(this->filesystem, in, out, connection.fd).run();
+    out.flush();
+    this->filesystem.closeSession(session);
+
+    // The client learns that the session ended right away, the socket is closed when the thread is joined
+    shutdown(connection.fd, SHUT_RDWR);
+    connection.done = true;
+}
+
+// Joins the sessions that ended, or ends every session by hanging up on its client
+void Server::reap(bool all) {
+    for (auto it = this->connections.begin(); it != this->connections.end();) {
+        if (!all && !it->done) {
+            it++;
+            continue;
+        }
+        if (all) shutdown(it->fd, SHUT_RDWR);
+        it->thread.join();
+        close(it->fd);
+        it = this->connections.erase(it);
+    }
+}
@@ -0,0 +1,54 @@
+#include <atomic>
+#include <list>
+#include <string>
+#include <thread>
+
+#include "fs.h"
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+/// @brief Serves shell sessions over a Unix domain socket. Every connection gets a thread and a working directory of
+/// its own, and all of them share one mounted file system.
+class Server {
+   public:
+    /// @brief Binds the server to a file system, nothing is listened on yet.
+    /// @param filesystem The mounted file system every session works on.
+    /// @param socketPath Path of the socket, an old socket file there is replaced.
+    Server(FS& filesystem, const std::string& socketPath);
+
+    /// @brief Ends the sessions that are still connected and removes the socket.
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /// @brief Accepts sessions until SIGINT or SIGTERM arrives.
+    /// @return 0 if the server stopped on a signal else -1 if the socket couldn't be set up.
+    int run();
+
+   private:
+    /// @brief One connected client.
+    struct Connection {
+        int fd;                  // the connected socket, closed once the thread is joined
+        std::thread thread;      // runs the session
+        std::atomic<bool> done;  // set by the thread when the session ended
+    };
+
+    /// @brief Runs one session on a connected socket.
+    /// @param connection The connection.
+    void serve(Connection& connection);
+
+    /// @brief Joins the threads of the sessions that ended and closes their sockets.
+    /// @param all Whether to end and join every session.
+    void reap(bool all);
+
+    FS& filesystem;
+    std::string socketPath;
+    int listenFd;
+
+    // Only touched by the thread in run()
+    std::list<Connection> connections;
+};
+
+#endif  // __SERVER_H__
@@ -0,0 +1,240 @@
+#include "session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#define ANY_ARITY (~0u)
+
+static const char createUsage[] = "Usage: create <file> [<<TAG | < <hostfile>]\n";
+static const char mkdirUsage[] = "Usage: mkdir [-b] <dirpath>\n";
+
+// The commands in the order help lists them
+const Session::Command Session::commands[] = {
+    {"format", 1u << 0 | 1u << 2, "Usage: format [<blocks> <fatbits>]\n", 0, &Session::format},
+    {"create", 1u << 1 | 1u << 2 | 1u << 3, createUsage, 1, &Session::create},
+    {"cat", 1u << 1, "Usage: cat <file>\n", 1, &Session::cat},
+    {"ls", 1u << 0, "Usage: ls\n", 0, &Session::ls},
+    {"cp", 1u << 2, "Usage: <oldfile> <newfile>\n", 2, &Session::cp},
+    {"mv", 1u << 2, "Usage: mv <sourcepath> <destpath>\n", 2, &Session::mv},
+    {"rm", 1u << 1, "Usage: rm <file>\n", 1, &Session::rm},
+    {"append", 1u << 2, "Usage: append <filepath1> <filepath2>\n", 2, &Session::append},
+    {"mkdir", 1u << 1 | 1u << 2, mkdirUsage, 2, &Session::mkdir},
+    {"cd", 1u << 1, "Usage: cd <dirpath>\n", 1, &Session::cd},
+    {"pwd", 1u << 0, "Usage: pwd\n", 0, &Session::pwd},
+    {"chmod", 1u << 2, "Usage: chmod <accessrights> <filepath>\n", 2, &Session::chmod},
+    {"read", 1u << 3, "Usage: read <file> <offset> <length>\n", 1, &Session::read},
+    {"stats", 1u << 0 | 1u << 1, "Usage: stats [reset]\n", 0, &Session::stats},
+    {"help", ANY_ARITY, "", 0, &Session::help},
+    {"quit", ANY_ARITY, "", 0, &Session::quit},
+};
+
+TraceWriter* Session::trace = nullptr;
+
+// Passes every read through to another buffer without buffering anything itself, so nothing past the data of
+// create is taken from the session input, and counts what was taken
+class CountingBuf : public std::streambuf {
+   public:
+    CountingBuf(std::streambuf* source) : source(source), count(0) {}
+    uint64_t taken() const { return this->count; }
+
+   protected:
+    int underflow() override { return this->source->sgetc(); }
+    int uflow() override {
+        int c = this->source->sbumpc();
+        if (c != traits_type::eof()) this->count++;
+        return c;
+    }
+    std::streamsize xsgetn(char* data, std::streamsize size) override {
+        std::streamsize got = this->source->sgetn(data, size);
+        this->count += got;
+        return got;
+    }
+
+   private:
+    std::streambuf* source;
+    uint64_t count;
+};
+
+Session::Session(FS& filesystem, std::istream& in, std::ostream& out, int outFd, bool batch)
+    : filesystem(filesystem), in(in), out(out), outFd(outFd), batch(batch), running(false),
+      traceSession(trace ? trace->newSession() : 0), dataSize(0) {}
+
+// Reads a line at a time, splits it in place and looks the command up in the dispatch table
+void Session::run() {
+    const size_t count = sizeof(commands) / sizeof(commands[0]);
+    this->running = true;
+    while (this->running) {
+        if (!this->batch) this->out << "filesystem> ";
+        if (!std::getline(this->in, this->line)) break;
+        const Args& args = this->tokenizer.split(this->line);
+
+        if (DEBUG) {
+            this->out << "Line: " << this->line << std::endl;
+            for (unsigned i = 0; i < args.size(); ++i) this->out << "cmd/arg: " << args[i] << "\n";
+        }
+
+        if (args.empty()) continue;
+        const Command* command = nullptr;
+        for (size_t i = 0; i < count && !command; i++)
+            if (args[0] == commands[i].name) command = &commands[i];
+        if (!command) {
+            this->help(args);
+            continue;
+        }
+
+        size_t arity = args.size() - 1;
+        if (arity >= 32 || !(command->arities & 1u << arity)) {
+            this->out << command->usage;
+            continue;
+        }
+        // check return value so everything is ok
+        std::chrono::steady_clock::time_point start;
+        if (trace) start = std::chrono::steady_clock::now();
+        this->dataSize = 0;
+        int ret_val = (this->*command->handler)(args);
+        if (trace) trace->record(this->traceSession, start, args, this->dataSize);
+        if (ret_val) {
+            this->out << "Error: " << command->name;
+            for (size_t i = 1; i <= std::min(command->echoed, arity); i++) this->out << " " << args[i];
+            this->out << " failed, error code " << ret_val << std::endl;
+        }
+    }
+}
+
+// Numbers are parsed straight from the line, which ends every token with a blank or the terminating null
+int Session::format(const Args& args) {
+    if (args.size() == 3)
+        return this->filesystem.format(std::strtoul(args[1].data(), nullptr, 10), std::atoi(args[2].data()));
+    return this->filesystem.format();
+}
+
+// The data is the rows up to an empty one, the rows up to TAG for <<TAG, or all of a host file for < <hostfile>
+int Session::create(const Args& args) {
+    if (args.size() == 3) {
+        if (!args[2].startsWith("<<") || args[2].size() == 2) {
+            this->out << createUsage;
+            return 0;
+        }
+        StringView tag = args[2].substr(2);
+        std::string data;
+        std::string row;
+        while (std::getline(this->in, row) && tag != row.c_str()) {
+            data += row;
+            data += '\n';
+        }
+        std::istringstream input(data);
+        return this->create(args[1].str(), input, true);
+    }
+    if (args.size() == 4) {
+        if (args[2] != "<") {
+            this->out << createUsage;
+            return 0;
+        }
+        std::ifstream input(args[3].str().c_str(), std::ios::binary);
+        if (!input) {
+            this->out << "Error: cannot open " << args[3] << std::endl;
+            return 0;
+        }
+        return this->create(args[1].str(), input, true);
+    }
+    if (!this->batch) this->out << "Enter data. Empty line to end.\n";
+    return this->create(args[1].str(), this->in, false);
+}
+
+// The data is only counted while a trace is recorded
+int Session::create(const std::string& filepath, std::istream& source, bool wholeStream) {
+    if (!trace) return this->filesystem.create(filepath, source, wholeStream);
+    CountingBuf counter(source.rdbuf());
+    std::istream input(&counter);
+    int ret_val = this->filesystem.create(filepath, input, wholeStream);
+    this->dataSize = counter.taken();
+    return ret_val;
+}
+
+// Whatever is buffered has to come out before the file is sent to the descriptor
+int Session::cat(const Args& args) {
+    this->out.flush();
+    return this->filesystem.cat(args[1].str(), this->outFd);
+}
+
+int Session::ls(const Args&) { return this->filesystem.ls(this->out); }
+
+int Session::cp(const Args& args) { return this->filesystem.cp(args[1].str(), args[2].str()); }
+
+int Session::mv(const Args& args) { return this->filesystem.mv(args[1].str(), args[2].str()); }
+
+int Session::rm(const Args& args) { return this->filesystem.rm(args[1].str()); }
+
+int Session::append(const Args& args) { return this->filesystem.append(args[1].str(), args[2].str()); }
+
+// mkdir -b keeps the entries of the new directories in a B-tree from the start
+int Session::mkdir(const Args& args) {
+    if (args.size() == 2) return this->filesystem.mkdir(args[1].str());
+    if (args[1] != "-b") {
+        this->out << mkdirUsage;
+        return 0;
+    }
+    return this->filesystem.mkdir(args[2].str(), FS::BTREE);
+}
+
+int Session::cd(const Args& args) { return this->filesystem.cd(args[1].str()); }
+
+int Session::pwd(const Args&) { return this->filesystem.pwd(this->out); }
+
+int Session::chmod(const Args& args) { return this->filesystem.chmod(args[1].str(), args[2].str()); }
+
+// Reads the range a chunk at a time through a read handle
+int Session::read(const Args& args) {
+    int handle = this->filesystem.open(args[1].str(), READ);
+    if (handle < 0) return -1;
+    int ret_val = 0;
+    uint64_t offset = std::strtoull(args[2].data(), nullptr, 10);
+    uint64_t left = std::strtoull(args[3].data(), nullptr, 10);
+    std::vector<char> chunk(BLOCK_SIZE * 16);
+    while (left > 0) {
+        int64_t got = this->filesystem.pread(handle, chunk.data(), std::min<uint64_t>(left, chunk.size()), offset);
+        if (got <= 0) {
+            if (got < 0) ret_val = -1;
+            break;
+        }
+        this->out.write(chunk.data(), got);
+        offset += got;
+        left -= got;
+    }
+    this->filesystem.close(handle);
+    return ret_val;
+}
+
+// Prints the counters, or sets them to zero for stats reset
+int Session::stats(const Args& args) {
+    if (args.size() == 1) return this->filesystem.stats(this->out);
+    if (args[1] != "reset")
+        this->out << "Usage: stats [reset]\n";
+    else
+        this->filesystem.resetStats();
+    return 0;
+}
+
+// Lists the commands of the dispatch table, unknown commands get the same list
+int Session::help(const Args&) {
+    const size_t count = sizeof(commands) / sizeof(commands[0]);
+    this->out << "Available commands:\n";
+    for (size_t i = 0; i < count; i++) this->out << (i ? ", " : "") << commands[i].name;
+    this->out << "\n";
+    return 0;
+}
+
+int Session::quit(const Args&) {
+    this->running = false;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+// reads commands from one stream and runs them on a file system that may be
+// shared with other sessions, until quit or the end of the stream
+class Session {
+   private:
+    FS& filesystem;
+    std::istream& in;
+    std::ostream& out;
+    // where cat sends file contents, out is flushed first
+    int outFd;
+    // batch sessions run a script, so there is no prompt and nothing asks
+    // for data
+    bool batch;
+    bool running;
+    // number of the session in the trace
+    uint32_t traceSession;
+    // bytes of data the running command read, recorded in the trace
+    uint64_t dataSize;
+    // the current command line, the tokens point into it
+    std::string line;
+    Tokenizer tokenizer;
+
+    typedef std::vector<StringView> Args;
+
+    // a command of the dispatch table, args[0] is the command name
+    struct Command {
+        const char* name;
+        // bit n is set when the command takes n arguments
+        unsigned arities;
+        const char* usage;
+        // how many arguments are repeated in the error message
+        size_t echoed;
+        int (Session::*handler)(const Args& args);
+    };
+    static const Command commands[];
+
+    int format(const Args& args);
+    int create(const Args& args);
+    int cat(const Args& args);
+    int ls(const Args& args);
+    int cp(const Args& args);
+    int mv(const Args& args);
+    int rm(const Args& args);
+    int append(const Args& args);
+    int mkdir(const Args& args);
+    int cd(const Args& args);
+    int pwd(const Args& args);
+    int chmod(const Args& args);
+    int read(const Args& args);
+    int stats(const Args& args);
+    int help(const Args& args);
+    int quit(const Args& args);
+
+    // reads the data of create from source, counting it in dataSize
+    int create(const std::string& filepath, std::istream& source, bool wholeStream);
+
+   public:
+    // every session records its commands here while it is set
+    static TraceWriter* trace;
+
+    Session(FS& filesystem, std::istream& in, std::ostream& out, int outFd, bool batch = false);
+    void run();
+};
+
+#endif  // __SESSION_H__
@@ -0,0 +1,67 @@
+#include "stats.h"
+
+thread_local OpStats::Activity* OpStats::current = nullptr;
+
+OpStats::OpStats() { this->reset(); }
+
+// Names in the order of Op
+const char* OpStats::name(Op op) {
+    static const char* names[OP_COUNT] = {"format", "create", "cat",   "ls",   "cp",    "mv",
+                                          "rm",     "append", "mkdir", "cd",   "pwd",   "chmod",
+                                          "sync",   "open",   "pread", "pwrite", "truncate", "flush"};
+    return op < OP_COUNT ? names[op] : "";
+}
+
+// Adds the operation to the counters of its kind, the bucket is the amount of bits in the latency
+void OpStats::record(Op op, uint64_t micros, const Activity& activity) {
+    Slot& slot = this->slots[op];
+    int bucket = 0;
+    while (bucket + 1 < LATENCY_BUCKETS && micros >> bucket) bucket++;
+    slot.calls.fetch_add(1, std::memory_order_relaxed);
+    slot.micros.fetch_add(micros, std::memory_order_relaxed);
+    slot.blockReads.fetch_add(activity.io.reads, std::memory_order_relaxed);
+    slot.blockWrites.fetch_add(activity.io.writes, std::memory_order_relaxed);
+    slot.dirBlocksScanned.fetch_add(activity.dirBlocksScanned, std::memory_order_relaxed);
+    slot.lookups.fetch_add(activity.lookups, std::memory_order_relaxed);
+    slot.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Copies the counters one at a time, operations that finish meanwhile may be partly counted
+OpStats::Counters OpStats::get(Op op) const {
+    const Slot& slot = this->slots[op];
+    Counters counters;
+    counters.calls = slot.calls.load(std::memory_order_relaxed);
+    counters.micros = slot.micros.load(std::memory_order_relaxed);
+    counters.blockReads = slot.blockReads.load(std::memory_order_relaxed);
+    counters.blockWrites = slot.blockWrites.load(std::memory_order_relaxed);
+    counters.dirBlocksScanned = slot.dirBlocksScanned.load(std::memory_order_relaxed);
+    counters.lookups = slot.lookups.load(std::memory_order_relaxed);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) counters.latency[i] = slot.latency[i].load(std::memory_order_relaxed);
+    return counters;
+}
+
+void OpStats::reset() {
+    for (Slot& slot : this->slots) {
+        slot.calls = 0;
+        slot.micros = 0;
+        slot.blockReads = 0;
+        slot.blockWrites = 0;
+        slot.dirBlocksScanned = 0;
+        slot.lookups = 0;
+        for (std::atomic<uint64_t>& bucket : slot.latency) bucket = 0;
+    }
+}
+
+// Walks the histogram until the share of the calls is covered
+uint64_t OpStats::percentile(const Counters& counters, double share) {
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) total += counters.latency[i];
+    if (!total) return 0;
+    uint64_t wanted = uint64_t(share * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += counters.latency[i];
+        if (seen > wanted) return uint64_t(1) << i;
+    }
+    return uint64_t(1) << (LATENCY_BUCKETS - 1);
+}
@@ -0,0 +1,81 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "disk.h"
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// Latency histogram bucket i counts calls that took less than 2^i microseconds, the last bucket also counts the rest
+#define LATENCY_BUCKETS 24
+
+/// @brief Always-on counters of the file system operations, kept per kind of operation. Every counter is a relaxed
+/// atomic so operations running at the same time count without waiting for each other.
+class OpStats {
+   public:
+    /// @brief The kinds of operations that are counted.
+    enum Op { FORMAT, CREATE, CAT, LS, CP, MV, RM, APPEND, MKDIR, CD, PWD, CHMOD, SYNC, OPEN, PREAD, PWRITE, TRUNCATE,
+              FLUSH, OP_COUNT };
+
+    /// @brief What the calling thread did during one operation, filled in while the operation runs.
+    struct Activity {
+        Disk::Stats io;             // disk blocks read and written
+        uint64_t dirBlocksScanned;  // directory blocks read
+        uint64_t lookups;           // names looked up in a directory
+    };
+
+    /// @brief A copy of the counters of one kind of operation.
+    struct Counters {
+        uint64_t calls;
+        uint64_t micros;            // latency of every call added up
+        uint64_t blockReads;        // disk blocks read by the calls
+        uint64_t blockWrites;       // disk blocks written by the calls
+        uint64_t dirBlocksScanned;  // directory blocks read by the calls
+        uint64_t lookups;           // names the calls looked up in a directory
+        uint64_t latency[LATENCY_BUCKETS];
+    };
+
+    /// @brief The activity of the operation the calling thread runs, nullptr outside of operations.
+    static thread_local Activity* current;
+
+    OpStats();
+    OpStats(const OpStats&) = delete;
+    OpStats& operator=(const OpStats&) = delete;
+
+    /// @return The lowercase name of a kind of operation.
+    static const char* name(Op op);
+
+    /// @brief Counts one finished operation.
+    /// @param op The kind of operation.
+    /// @param micros How long it took.
+    /// @param activity What it did.
+    void record(Op op, uint64_t micros, const Activity& activity);
+
+    /// @return The counters of one kind of operation.
+    Counters get(Op op) const;
+
+    /// @brief Sets every counter to zero.
+    void reset();
+
+    /// @brief Estimates the latency below which a share of the calls finished, from the histogram.
+    /// @param counters The counters of one kind of operation.
+    /// @param share Share of the calls, between 0 and 1.
+    /// @return Upper bound of the bucket the share falls in, in microseconds.
+    static uint64_t percentile(const Counters& counters, double share);
+
+   private:
+    struct Slot {
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> micros;
+        std::atomic<uint64_t> blockReads;
+        std::atomic<uint64_t> blockWrites;
+        std::atomic<uint64_t> dirBlocksScanned;
+        std::atomic<uint64_t> lookups;
+        std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latency;
+    };
+
+    std::array<Slot, OP_COUNT> slots;
+};
+
+#endif  // __STATS_H__
@@ -0,0 +1,30 @@
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+#include <stdint.h>
+
+// "SFAT" in a little-endian word, a volume without it in block 1 has its FAT there
+#define SUPER_MAGIC 0x54414653
+// Version 3 volumes may have directories stored as B-trees
+#define SUPER_VERSION 3
+
+struct superblock {
+    uint32_t magic;       // SUPER_MAGIC
+    uint32_t version;     // layout version, SUPER_VERSION
+    uint32_t block_size;  // size of a block in bytes
+    uint32_t no_blocks;   // blocks on the volume, one FAT entry each
+    uint32_t fat_bits;    // width of a FAT entry, 16 or 32
+    uint32_t fat_start;   // first block of the FAT
+    uint32_t fat_blocks;  // amount of blocks the FAT is stored in
+    uint32_t journal_start;   // first block of the metadata journal
+    uint32_t journal_blocks;  // amount of blocks in the journal, 0 if the volume has none
+    uint32_t shares_start;    // first block of the share table, 0 if no chain was ever shared
+};
+
+// Entry in the share table, which counts the files sharing a chain besides the first one. The table is a FAT chain
+// of blocks full of entries, an entry with refs 0 ends the entries of its block.
+struct share_entry {
+    uint32_t first_blk;  // first block of the shared chain
+    uint32_t refs;       // amount of extra files using the chain
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "session.h"
+#include "test_script.h"
+#include "tokenizer.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Prints the tokens of a line in brackets
+static void printTokens(Tokenizer& tokenizer, const std::string& line) {
+    const std::vector<StringView>& tokens = tokenizer.split(line);
+    std::cout << tokens.size() << ":";
+    for (const StringView& token : tokens) std::cout << " [" << token << "]";
+    std::cout << std::endl;
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    Tokenizer tokenizer;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 10 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing the tokenizer..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "3: [cp] [f1] [f2]" << std::endl;
+    std::cout << "2: [mkdir] [d1]" << std::endl;
+    std::cout << "0:" << std::endl;
+    std::cout << "0:" << std::endl;
+    std::cout << "1: [pwd]" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    printTokens(tokenizer, "cp f1 f2");
+    printTokens(tokenizer, "   mkdir    d1   ");
+    printTokens(tokenizer, "");
+    printTokens(tokenizer, "     ");
+    printTokens(tokenizer, "pwd");
+    std::cout << "-----" << std::endl;
+
+    // Tokens point into the line instead of holding copies of it
+    std::cout << "tokens point into the line..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "yes" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::string line = "append f1 f2";
+    const std::vector<StringView>& tokens = tokenizer.split(line);
+    std::cout << (tokens.size() == 3 && tokens[1].data() == line.data() + 7
+                      ? "yes"
+                      : "no")
+              << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "StringView comparisons..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "1 0 0 1 0" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    StringView view(line.data(), 6);
+    std::cout << (view == "append") << " " << (view == "app") << " "
+              << (view == "appended") << " " << view.startsWith("app") << " "
+              << view.substr(3).startsWith("append") << std::endl;
+    PRINTDIV2;
+
+    // Commands are looked up in the dispatch table and checked for their
+    // amount of arguments before they run
+    std::cout << "Testing the dispatch table..." << std::endl;
+    filesystem.format();
+    std::istringstream script(
+        "create f1 <<EOF\n"
+        "hej heja\n"
+        "EOF\n"
+        "create f2\n"
+        "rows up to\n"
+        "an empty row\n"
+        "\n"
+        "   \n"
+        "cat   f1\n"
+        "cat f2\n"
+        "mkdir -b d1\n"
+        "mkdir -x d2\n"
+        "mkdir a b c\n"
+        "cp f1\n"
+        "cp f1 d1/f3\n"
+        "ls\n"
+        "cat missing\n"
+        "chmod 7 missing\n"
+        "read f1 4 5\n"
+        "\n"
+        "list\n"
+        "quit\n"
+        "ls\n");
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "hej heja" << std::endl;
+    std::cout << "rows up to" << std::endl;
+    std::cout << "an empty row" << std::endl;
+    std::cout << "Usage: mkdir [-b] <dirpath>" << std::endl;
+    std::cout << "Usage: mkdir [-b] <dirpath>" << std::endl;
+    std::cout << "Usage: <oldfile> <newfile>" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "f1\t file\t rw-\t 9" << std::endl;
+    std::cout << "f2\t file\t rw-\t 24" << std::endl;
+    std::cout << "d1\t dir\t rw-\t -" << std::endl;
+    std::cout << "Error: cat missing failed, error code -1" << std::endl;
+    std::cout << "Error: chmod 7 missing failed, error code -1" << std::endl;
+    std::cout << "heja" << std::endl;
+    std::cout << "Available commands:" << std::endl;
+    std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, "
+                 "chmod, read, stats, help, quit"
+              << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    Session session(filesystem, script, std::cout, STDOUT_FILENO, true);
+    session.run();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "ls(d1)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "f3\t file\t rw-\t 9" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.cd("d1");
+    filesystem.ls();
+    filesystem.cd("..");
+    PRINTDIV2;
+
+    std::cout << "... Task 10 done" << std::endl;
+    PRINTDIV;
+}
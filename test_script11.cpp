@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Lists the current directory and tells how many entries it has and
+// whether they are sorted by name
+static std::string listing(FS& fs) {
+    std::ostringstream out;
+    fs.ls(out);
+    std::istringstream rows(out.str());
+    std::string row;
+    std::string previous;
+    size_t count = 0;
+    bool sorted = true;
+    std::getline(rows, row);
+    while (std::getline(rows, row)) {
+        std::string name = row.substr(0, row.find('\t'));
+        if (count && name <= previous) sorted = false;
+        previous = name;
+        count++;
+    }
+    return std::to_string(count) + (sorted ? " sorted" : " unsorted");
+}
+
+// Looks names up with chmod and tells how many of them were found and how
+// many directory blocks a lookup read on average
+static std::string lookup(FS& fs, int first, int last, int step) {
+    fs.resetStats();
+    int found = 0;
+    for (int i = first; i < last; i += step)
+        if (fs.chmod("6", "f" + std::to_string(i)) == 0) found++;
+    OpStats::Counters chmod = fs.opStats().get(OpStats::CHMOD);
+    bool cheap = chmod.dirBlocksScanned <= 4 * chmod.calls;
+    return std::to_string(found) + " found" + (cheap ? ", cheap" : ", costly");
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    std::string arg1, arg2;
+    int ret_val = 0;
+    const int count = 1500;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 11 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing large directories..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    std::istringstream input("hej heja hejare\n");
+    filesystem.create("src", input, true);
+    filesystem.mkdir("tree", FS::BTREE);
+    filesystem.mkdir("linear", FS::LINEAR);
+
+    // Copies share the blocks of src, so the directories grow far past
+    // what fits in one block without filling the disk
+    std::cout << "cp(src, f0..f1499) in a B-tree and in a linear directory "
+                 "that turns into one..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "1500 sorted" << std::endl;
+    std::cout << "1500 sorted" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    const char* dirs[] = {"/tree", "/linear"};
+    for (const char* dir : dirs) {
+        filesystem.cd(dir);
+        for (int i = 0; i < count; i++) {
+            ret_val = filesystem.cp("/src", "f" + std::to_string(i));
+            if (ret_val) {
+                std::cout << "Error: cp(src,f" << i << ") failed, error code "
+                          << ret_val << std::endl;
+                break;
+            }
+        }
+        std::cout << listing(filesystem) << std::endl;
+    }
+    std::cout << "-----" << std::endl;
+
+    std::cout << "lookups of every 7th name and of missing names..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "215 found, cheap" << std::endl;
+    std::cout << "0 found, cheap" << std::endl;
+    std::cout << "215 found, cheap" << std::endl;
+    std::cout << "0 found, cheap" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    for (const char* dir : dirs) {
+        filesystem.cd(dir);
+        std::cout << lookup(filesystem, 0, count, 7) << std::endl;
+        std::cout << lookup(filesystem, count, count + 200, 1) << std::endl;
+    }
+    std::cout << "-----" << std::endl;
+
+    // Removing most entries merges the nodes back together
+    std::cout << "rm of every name but every 10th, then lookups..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "150 sorted" << std::endl;
+    std::cout << "150 found, cheap" << std::endl;
+    std::cout << "0 found, cheap" << std::endl;
+    std::cout << "150 sorted" << std::endl;
+    std::cout << "150 found, cheap" << std::endl;
+    std::cout << "0 found, cheap" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    for (const char* dir : dirs) {
+        filesystem.cd(dir);
+        for (int i = 0; i < count; i++) {
+            if (i % 10 == 0) continue;
+            ret_val = filesystem.rm("f" + std::to_string(i));
+            if (ret_val) {
+                std::cout << "Error: rm(f" << i << ") failed, error code "
+                          << ret_val << std::endl;
+                break;
+            }
+        }
+        std::cout << listing(filesystem) << std::endl;
+        std::cout << lookup(filesystem, 0, count, 10) << std::endl;
+        std::cout << lookup(filesystem, 1, count, 10) << std::endl;
+    }
+    std::cout << "-----" << std::endl;
+
+    // A new mount finds the directories from what is on the disk
+    std::cout << "sync, mount again, ls, lookups and mv between the "
+                 "directories..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "150 sorted" << std::endl;
+    std::cout << "150 found, cheap" << std::endl;
+    std::cout << "151 sorted" << std::endl;
+    std::cout << "149 sorted" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.cd("/");
+    filesystem.sync();
+    {
+        FS mounted;
+        mounted.cd("/tree");
+        std::cout << listing(mounted) << std::endl;
+        std::cout << lookup(mounted, 0, count, 10) << std::endl;
+        arg1 = "/linear/f730";
+        arg2 = "/tree/g730";
+        ret_val = mounted.mv(arg1, arg2);
+        if (ret_val)
+            std::cout << "Error: mv(" << arg1 << "," << arg2
+                      << ") failed, error code " << ret_val << std::endl;
+        std::cout << listing(mounted) << std::endl;
+        mounted.cd("/linear");
+        std::cout << listing(mounted) << std::endl;
+    }
+    PRINTDIV2;
+
+    // The shell's own file system still holds the disk as it was before the
+    // other mount, format it so that it leaves a consistent disk behind
+    filesystem.format();
+
+    std::cout << "... Task 11 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Creates a file holding data, with 0 or an error code for the result
+static int create(FS& fs, const std::string& path, const std::string& data) {
+    std::istringstream input(data);
+    return fs.create(path, input, true);
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    int ret_val = 0;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 12 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing a directory removed under another session..."
+              << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    filesystem.mkdir("d");
+    int session = filesystem.openSession();
+    filesystem.useSession(session);
+    ret_val = filesystem.cd("d");
+    if (ret_val)
+        std::cout << "Error: cd(d) failed, error code " << ret_val
+                  << std::endl;
+    filesystem.useSession(-1);
+
+    // The block of d is free once d is removed, but the session is still in
+    // d and must not end up in a new directory that takes the block
+    std::cout << "rm(d), sync, mkdir(e, f, g), create(x) in the session..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "0" << std::endl;
+    std::cout << "failed" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << filesystem.rm("d") << std::endl;
+    filesystem.sync();
+    filesystem.mkdir("e");
+    filesystem.mkdir("f");
+    filesystem.mkdir("g");
+    filesystem.useSession(session);
+    std::cout << (create(filesystem, "x", "hello") ? "failed" : "created")
+              << std::endl;
+    filesystem.useSession(-1);
+    filesystem.cd("e");
+    filesystem.ls();
+    filesystem.cd("..");
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cd(/) in the session, create(x) there..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "created" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "e\t dir\t rw-\t\t -" << std::endl;
+    std::cout << "f\t dir\t rw-\t\t -" << std::endl;
+    std::cout << "g\t dir\t rw-\t\t -" << std::endl;
+    std::cout << "x\t file\t rw-\t\t 5" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.useSession(session);
+    filesystem.cd("/");
+    std::cout << (create(filesystem, "x", "hello") ? "failed" : "created")
+              << std::endl;
+    filesystem.useSession(-1);
+    filesystem.closeSession(session);
+    filesystem.ls();
+    PRINTDIV2;
+
+    std::cout << "... Task 12 done" << std::endl;
+    PRINTDIV;
+}
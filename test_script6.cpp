@@ -0,0 +1,117 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    std::string arg1, arg2;
+    int ret_val = 0;
+    int status = 0;
+    pid_t pid;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 6 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing crash recovery of shared files..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    filesystem.sync();
+
+    // The child copies a file and dies right after the commit, without
+    // writing anything home, the next mount has to replay the journal
+    std::cout << "create(a), cp(a,b), sync, crash..." << std::endl;
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0) {
+        FS crashing;
+        std::istringstream input("AAAA\n");
+        crashing.create("a", input, true);
+        crashing.cp("a", "b");
+        crashing.sync();
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        std::cout << "Error: the crashing process failed" << std::endl;
+
+    {
+        FS recovered;
+        std::cout << "rm(a), sync, create(c)..." << std::endl;
+        arg1 = "a";
+        ret_val = recovered.rm(arg1);
+        if (ret_val)
+            std::cout << "Error: rm(" << arg1 << ") failed, error code "
+                      << ret_val << std::endl;
+        // Freed blocks are only reused once the rm is committed
+        recovered.sync();
+        std::istringstream input("CCCC\n");
+        ret_val = recovered.create("c", input, true);
+        if (ret_val)
+            std::cout << "Error: create(c) failed, error code " << ret_val
+                      << std::endl;
+
+        std::cout << "cat(b)..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "AAAA" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::cout.flush();
+        arg1 = "b";
+        recovered.cat(arg1);
+        std::cout << "-----" << std::endl;
+
+        std::cout << "cat(c)..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "CCCC" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::cout.flush();
+        arg1 = "c";
+        recovered.cat(arg1);
+        std::cout << "-----" << std::endl;
+
+        std::cout << "append(c,b)..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "AAAA" << std::endl;
+        std::cout << "CCCC" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::cout.flush();
+        arg1 = "c";
+        arg2 = "b";
+        recovered.append(arg1, arg2);
+        recovered.cat(arg2);
+    }
+    PRINTDIV2;
+
+    // The shell's own file system still holds the disk as it was before the
+    // crash, format it so that it leaves a consistent disk behind
+    filesystem.format();
+
+    std::cout << "... Task 6 done" << std::endl;
+    PRINTDIV;
+}
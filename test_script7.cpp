@@ -0,0 +1,145 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Creates f0, f1, ... holding content and the number of the file, every
+// file is committed to the journal on its own
+static void createFiles(FS& fs, const std::string& content, int count) {
+    for (int i = 0; i < count; i++) {
+        std::string name = "f" + std::to_string(i);
+        std::istringstream input(content + std::to_string(i) + "\n");
+        if (fs.create(name, input, true))
+            std::cout << "Error: create(" << name << ") failed" << std::endl;
+        fs.sync();
+    }
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    std::string arg1, arg2;
+    int ret_val = 0;
+    int status = 0;
+    pid_t pid;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 7 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing journal replay..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    filesystem.sync();
+
+    // The journal region of the first volume is left full of committed
+    // transactions, which must not be replayed on the next volume
+    std::cout << "create(f0..f5) on a volume that is formatted again..."
+              << std::endl;
+    {
+        FS previous;
+        createFiles(previous, "old", 6);
+    }
+    filesystem.format();
+    filesystem.sync();
+
+    // The child dies right after its last commit, nothing of it has been
+    // written home
+    std::cout << "create(f0..f2), mkdir(d1), mv(f2,d1), chmod(2,f1), sync, "
+                 "crash..."
+              << std::endl;
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0) {
+        FS crashing;
+        createFiles(crashing, "new", 3);
+        crashing.mkdir("d1");
+        crashing.mv("f2", "d1");
+        crashing.chmod("2", "f1");
+        crashing.sync();
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        std::cout << "Error: the crashing process failed" << std::endl;
+
+    {
+        FS recovered;
+        std::cout << "replayed transactions..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "yes" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::cout << (recovered.journalStats().replayed ? "yes" : "no")
+                  << std::endl;
+        std::cout << "-----" << std::endl;
+
+        std::cout << "ls()..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "name\t type\t accessrights\t size" << std::endl;
+        std::cout << "f0\t file\t rw-\t 5" << std::endl;
+        std::cout << "f1\t file\t -w-\t 5" << std::endl;
+        std::cout << "d1\t dir\t rw-\t -" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        recovered.ls();
+        std::cout << "-----" << std::endl;
+
+        std::cout << "cat(f0), cat(d1/f2)..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "new0" << std::endl;
+        std::cout << "new2" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::cout.flush();
+        arg1 = "f0";
+        recovered.cat(arg1);
+        arg1 = "d1/f2";
+        recovered.cat(arg1);
+        std::cout << "-----" << std::endl;
+
+        std::cout << "create(f3), ls()..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "name\t type\t accessrights\t size" << std::endl;
+        std::cout << "f0\t file\t rw-\t 5" << std::endl;
+        std::cout << "f1\t file\t -w-\t 5" << std::endl;
+        std::cout << "d1\t dir\t rw-\t -" << std::endl;
+        std::cout << "f3\t file\t rw-\t 5" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        std::istringstream input("new3\n");
+        ret_val = recovered.create("f3", input, true);
+        if (ret_val)
+            std::cout << "Error: create(f3) failed, error code " << ret_val
+                      << std::endl;
+        recovered.ls();
+    }
+    PRINTDIV2;
+
+    // The shell's own file system still holds the disk as it was before the
+    // crash, format it so that it leaves a consistent disk behind
+    filesystem.format();
+
+    std::cout << "... Task 7 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Byte at offset i of the test file, every block differs from the others
+static char pattern(size_t i) { return 'a' + (i / BLOCK_SIZE * 7 + i) % 26; }
+
+// Reads length bytes at offset through a handle and tells whether they are
+// the expected ones
+static std::string check(FS& fs, int handle, uint64_t offset, size_t length,
+                         const std::string& expected) {
+    std::vector<char> data(length + 1);
+    int64_t got = fs.pread(handle, data.data(), length, offset);
+    if (got < 0) return "error";
+    if (std::string(data.data(), got) != expected) return "mismatch";
+    return "ok " + std::to_string(got);
+}
+
+// The expected bytes of the test file from offset on
+static std::string expected(size_t offset, size_t length) {
+    std::string data;
+    for (size_t i = offset; i < offset + length; i++) data += pattern(i);
+    return data;
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    std::string arg1, arg2;
+    int ret_val = 0;
+    int handle = 0;
+    const size_t size = 40 * BLOCK_SIZE + 123;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 8 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing file handles..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    std::istringstream input(expected(0, size));
+    filesystem.create("big", input, true);
+
+    std::cout << "open(big, rw)..." << std::endl;
+    handle = filesystem.open("big", READ | WRITE);
+    if (handle < 0) std::cout << "Error: open(big) failed" << std::endl;
+
+    // Reads far into the chain find their block without walking the FAT
+    // from the start, in any order
+    std::cout << "pread at the end, in the middle, across a block and at "
+                 "the start..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "ok 23" << std::endl;
+    std::cout << "ok 0" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << check(filesystem, handle, 39 * BLOCK_SIZE, 100,
+                       expected(39 * BLOCK_SIZE, 100))
+              << std::endl;
+    std::cout << check(filesystem, handle, 20 * BLOCK_SIZE + 7, 100,
+                       expected(20 * BLOCK_SIZE + 7, 100))
+              << std::endl;
+    std::cout << check(filesystem, handle, 3 * BLOCK_SIZE - 50, 100,
+                       expected(3 * BLOCK_SIZE - 50, 100))
+              << std::endl;
+    std::cout << check(filesystem, handle, 0, 100, expected(0, 100))
+              << std::endl;
+    std::cout << check(filesystem, handle, size - 23, 100,
+                       expected(size - 23, 23))
+              << std::endl;
+    std::cout << check(filesystem, handle, size, 100, "") << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cp(big,copy), pwrite across a block of big..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 11" << std::endl;
+    std::cout << "ok 11" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "big";
+    arg2 = "copy";
+    filesystem.cp(arg1, arg2);
+    if (filesystem.pwrite(handle, "hello world", 11, 10 * BLOCK_SIZE - 5) !=
+        11)
+        std::cout << "Error: pwrite failed" << std::endl;
+    std::cout << check(filesystem, handle, 10 * BLOCK_SIZE - 5, 11,
+                       "hello world")
+              << std::endl;
+    int copy = filesystem.open("copy", READ);
+    std::cout << check(filesystem, copy, 10 * BLOCK_SIZE - 5, 11,
+                       expected(10 * BLOCK_SIZE - 5, 11))
+              << std::endl;
+    filesystem.close(copy);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "pwrite past the end..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 3" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "big\t file\t rw-\t 174966" << std::endl;
+    std::cout << "copy\t file\t rw-\t 163963" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.pwrite(handle, "end", 3, size + 11000);
+    std::cout << check(filesystem, handle, size + 11000, 3, "end")
+              << std::endl;
+    std::cout << check(filesystem, handle, size + 5000, 100,
+                       std::string(100, '\0'))
+              << std::endl;
+    filesystem.ls();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "truncate(5000), then truncate(9000)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 10" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "ok 100" << std::endl;
+    std::cout << "name\t type\t accessrights\t size" << std::endl;
+    std::cout << "big\t file\t rw-\t 9000" << std::endl;
+    std::cout << "copy\t file\t rw-\t 163963" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    ret_val = filesystem.truncate(handle, 5000);
+    if (ret_val)
+        std::cout << "Error: truncate(5000) failed, error code " << ret_val
+                  << std::endl;
+    std::cout << check(filesystem, handle, 4990, 100, expected(4990, 10))
+              << std::endl;
+    ret_val = filesystem.truncate(handle, 9000);
+    if (ret_val)
+        std::cout << "Error: truncate(9000) failed, error code " << ret_val
+                  << std::endl;
+    std::cout << check(filesystem, handle, 4900, 100, expected(4900, 100))
+              << std::endl;
+    std::cout << check(filesystem, handle, 5000, 100, std::string(100, '\0'))
+              << std::endl;
+    filesystem.ls();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "close, then pread, and open(copy, w) after chmod(4,copy)..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "error" << std::endl;
+    std::cout << "-1" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.close(handle);
+    std::cout << check(filesystem, handle, 0, 100, "") << std::endl;
+    arg1 = "4";
+    arg2 = "copy";
+    filesystem.chmod(arg1, arg2);
+    std::cout << filesystem.open("copy", WRITE) << std::endl;
+    PRINTDIV2;
+
+    std::cout << "... Task 8 done" << std::endl;
+    PRINTDIV;
+}
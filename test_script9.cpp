@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fs.h"
+#include "test_script.h"
+
+#define PRINTDIV                                                               \
+    std::cout << "===========================================================" \
+                 "====================="                                       \
+              << std::endl
+#define PRINTDIV2 \
+    std::cout << "----------------------------------------" << std::endl
+
+// Content of a test file, every block differs from the others
+static std::string content(char first, size_t size) {
+    std::string data;
+    for (size_t i = 0; i < size; i++)
+        data += char(first + (i / BLOCK_SIZE * 7 + i) % 26);
+    return data;
+}
+
+// Sends a file to a temporary file with cat and tells whether it arrived
+// as expected
+static std::string check(FS& fs, const std::string& path,
+                         const std::string& expected) {
+    char name[] = "/tmp/test9XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) return "error";
+    unlink(name);
+    int ret = fs.cat(path, fd);
+    std::string data;
+    char buffer[BLOCK_SIZE];
+    ssize_t got;
+    lseek(fd, 0, SEEK_SET);
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, got);
+    close(fd);
+    if (ret) return "error";
+    if (data != expected) return "mismatch";
+    return "ok " + std::to_string(data.size());
+}
+
+Shell::Shell() { std::cout << "Creating and starting shell...\n"; }
+
+Shell::~Shell() { std::cout << "Exiting shell...\n"; }
+
+void Shell::run() {
+    std::string arg1, arg2;
+    std::string big = content('a', 30 * BLOCK_SIZE + 100);
+    std::string small = content('A', 5 * BLOCK_SIZE - 100);
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / "
+                 "\\ / \\ / \\ / \\ / \\ / \\ / \\ /"
+              << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 9 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing cat to a file descriptor..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+
+    std::cout << "cat of a contiguous file..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 122980" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::istringstream input1(big);
+    filesystem.create("big", input1, true);
+    std::cout << check(filesystem, "big", big) << std::endl;
+    std::cout << "-----" << std::endl;
+
+    // Two files grown a block at a time in turns are split into runs of
+    // one block each
+    std::cout << "cat of files in many runs..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 20481" << std::endl;
+    std::cout << "ok 20481" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.setAllocPolicy(FS::FIRST_FIT);
+    std::string odd = "x";
+    std::string even = "y";
+    std::istringstream start1(odd);
+    std::istringstream start2(even);
+    filesystem.create("odd", start1, true);
+    filesystem.create("even", start2, true);
+    arg1 = "part";
+    for (int i = 0; i < 10; i++) {
+        std::string part = content('a' + i, BLOCK_SIZE);
+        std::istringstream input(part);
+        filesystem.create(arg1, input, true);
+        arg2 = i % 2 ? "odd" : "even";
+        filesystem.append(arg1, arg2);
+        (i % 2 ? odd : even) += part;
+        filesystem.rm(arg1);
+    }
+    std::cout << check(filesystem, "odd", odd) << std::endl;
+    std::cout << check(filesystem, "even", even) << std::endl;
+    filesystem.setAllocPolicy(FS::CONTIGUOUS);
+    std::cout << "-----" << std::endl;
+
+    // Batched appends are only in memory until cat writes them out
+    std::cout << "cat after batched appends..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 20385" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::istringstream input2(small);
+    filesystem.create("small", input2, true);
+    std::istringstream input3("tail\n");
+    filesystem.create("tail", input3, true);
+    filesystem.setAppendBatching(true);
+    arg1 = "tail";
+    arg2 = "small";
+    filesystem.append(arg1, arg2);
+    std::cout << check(filesystem, "small", small + "tail\n") << std::endl;
+    filesystem.setAppendBatching(false);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat of a copy after the original is written..."
+              << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "ok 122980" << std::endl;
+    std::cout << "ok 122985" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "big";
+    arg2 = "copy";
+    filesystem.cp(arg1, arg2);
+    arg1 = "tail";
+    arg2 = "big";
+    filesystem.append(arg1, arg2);
+    std::cout << check(filesystem, "copy", big) << std::endl;
+    std::cout << check(filesystem, "big", big + "tail\n") << std::endl;
+    PRINTDIV2;
+
+    std::cout << "... Task 9 done" << std::endl;
+    PRINTDIV;
+}
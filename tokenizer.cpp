@@ -0,0 +1,15 @@
+#include "tokenizer.h"
+
+// Scans the line once, every token is a view into it
+const std::vector<StringView>& Tokenizer::split(const std::string& line) {
+    this->tokens.clear();
+    const char* at = line.data();
+    const char* end = at + line.size();
+    while (at < end) {
+        while (at < end && *at == ' ') at++;
+        const char* start = at;
+        while (at < end && *at != ' ') at++;
+        if (at > start) this->tokens.push_back(StringView(start, at - start));
+    }
+    return this->tokens;
+}
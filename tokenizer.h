@@ -0,0 +1,61 @@
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef __TOKENIZER_H__
+#define __TOKENIZER_H__
+
+/// @brief Characters owned by someone else, standing in for std::string_view which C++11 doesn't have.
+class StringView {
+   public:
+    StringView() : start(nullptr), length(0) {}
+    StringView(const char* start, size_t length) : start(start), length(length) {}
+
+    const char* data() const { return this->start; }
+    size_t size() const { return this->length; }
+    bool empty() const { return this->length == 0; }
+    char operator[](size_t i) const { return this->start[i]; }
+
+    /// @brief Compares the characters with a C string.
+    bool operator==(const char* other) const {
+        return std::strlen(other) == this->length && std::memcmp(this->start, other, this->length) == 0;
+    }
+    bool operator!=(const char* other) const { return !(*this == other); }
+
+    /// @brief Checks whether the characters begin with a C string.
+    bool startsWith(const char* prefix) const {
+        size_t prefixLength = std::strlen(prefix);
+        return prefixLength <= this->length && std::memcmp(this->start, prefix, prefixLength) == 0;
+    }
+
+    /// @brief The characters from pos to the end.
+    StringView substr(size_t pos) const { return StringView(this->start + pos, this->length - pos); }
+
+    /// @brief Copies the characters into a string.
+    std::string str() const { return std::string(this->start, this->length); }
+
+   private:
+    const char* start;
+    size_t length;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const StringView& view) {
+    return out.write(view.data(), view.size());
+}
+
+/// @brief Splits lines into blank separated tokens that point into the line. The token list is kept between lines,
+/// so once it has grown to the longest line nothing is allocated.
+class Tokenizer {
+   public:
+    /// @brief Splits a line, the tokens are valid until the line changes.
+    /// @param line The line to split.
+    /// @return The tokens of the line, runs of blanks are skipped.
+    const std::vector<StringView>& split(const std::string& line);
+
+   private:
+    std::vector<StringView> tokens;
+};
+
+#endif  // __TOKENIZER_H__
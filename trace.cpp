@@ -0,0 +1,121 @@
+#include "trace.h"
+
+// A record is the command id plus one, the change of its start time since the record before it, zigzag encoded, the
+// session, the amount of arguments, every argument as its length and bytes, and the data size. A record starting
+// with 0 instead defines the name of the next command id.
+
+TraceWriter::TraceWriter() : lastMicros(0), sessions(0) {}
+
+TraceWriter::~TraceWriter() { this->close(); }
+
+int TraceWriter::open(const std::string& path) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!this->file) return -1;
+    this->file.write(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    this->started = std::chrono::steady_clock::now();
+    this->lastMicros = 0;
+    this->commands.clear();
+    return this->file ? 0 : -1;
+}
+
+void TraceWriter::close() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->file.is_open()) this->file.close();
+}
+
+uint32_t TraceWriter::newSession() { return this->sessions++; }
+
+// Seven bits at a time, the high bit is set on every byte but the last
+void TraceWriter::put(uint64_t value) {
+    while (value >= 0x80) {
+        this->pending += char(value | 0x80);
+        value >>= 7;
+    }
+    this->pending += char(value);
+}
+
+// The record is built in memory and written with one call while the lock is held
+void TraceWriter::record(uint32_t session, std::chrono::steady_clock::time_point start,
+                         const std::vector<StringView>& args, uint64_t dataSize) {
+    if (args.empty()) return;
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (!this->file.is_open()) return;
+    this->pending.clear();
+
+    std::string name = args[0].str();
+    auto found = this->commands.find(name);
+    if (found == this->commands.end()) {
+        found = this->commands.emplace(name, this->commands.size()).first;
+        this->put(0);
+        this->put(name.size());
+        this->pending += name;
+    }
+
+    // Records are written in the order commands finished, so a start time may be earlier than the one before it
+    int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(start - this->started).count();
+    int64_t delta = micros - this->lastMicros;
+    this->lastMicros = micros;
+    this->put(found->second + 1);
+    this->put(delta < 0 ? (uint64_t(-(delta + 1)) << 1) | 1 : uint64_t(delta) << 1);
+    this->put(session);
+    this->put(args.size() - 1);
+    for (size_t i = 1; i < args.size(); i++) {
+        this->put(args[i].size());
+        this->pending.append(args[i].data(), args[i].size());
+    }
+    this->put(dataSize);
+    this->file.write(this->pending.data(), this->pending.size());
+}
+
+int TraceReader::open(const std::string& path) {
+    this->file.open(path.c_str(), std::ios::binary);
+    if (!this->file) return -1;
+    char magic[TRACE_MAGIC_SIZE];
+    if (!this->file.read(magic, TRACE_MAGIC_SIZE) || std::string(magic, TRACE_MAGIC_SIZE) != TRACE_MAGIC) return -1;
+    this->lastMicros = 0;
+    this->commands.clear();
+    return 0;
+}
+
+bool TraceReader::get(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = this->file.get();
+        if (c == std::char_traits<char>::eof()) return false;
+        value |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool TraceReader::get(std::string& value) {
+    uint64_t size;
+    if (!this->get(size) || size > TRACE_MAX_ARG) return false;
+    value.resize(size);
+    return size == 0 || this->file.read(&value[0], size);
+}
+
+// Name definitions are taken in on the way to the next record
+bool TraceReader::next(TraceRecord& record) {
+    uint64_t tag;
+    if (!this->get(tag)) return false;
+    while (tag == 0) {
+        std::string name;
+        if (!this->get(name)) return false;
+        this->commands.push_back(name);
+        if (!this->get(tag)) return false;
+    }
+    if (tag > this->commands.size()) return false;
+    record.command = this->commands[tag - 1];
+
+    uint64_t delta, session, count;
+    if (!this->get(delta) || !this->get(session) || !this->get(count) || count > TRACE_MAX_ARGS) return false;
+    this->lastMicros += delta & 1 ? -int64_t(delta >> 1) - 1 : int64_t(delta >> 1);
+    record.micros = this->lastMicros;
+    record.session = session;
+    record.args.resize(count);
+    for (std::string& arg : record.args)
+        if (!this->get(arg)) return false;
+    return this->get(record.dataSize);
+}
@@ -0,0 +1,103 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tokenizer.h"
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// First bytes of every trace file, the last one is the format version
+#define TRACE_MAGIC "FSTRACE\x01"
+#define TRACE_MAGIC_SIZE 8
+// Longest argument and most arguments a record may have, anything more means the trace is damaged
+#define TRACE_MAX_ARG 65536
+#define TRACE_MAX_ARGS 64
+
+/// @brief One command of a trace.
+struct TraceRecord {
+    int64_t micros;                 // when the command started, counted from the start of the trace
+    uint32_t session;               // the session that ran it, numbered from 0 in the order they started
+    std::string command;            // name of the command
+    std::vector<std::string> args;  // the arguments after the name
+    uint64_t dataSize;              // bytes of data create read, 0 for every other command
+};
+
+/// @brief Records the commands of every session to a compact binary trace. Numbers are varints and every command name
+/// is written once, the first time it is used, so a record takes a few bytes plus its arguments. Records are written in
+/// the order the commands finished.
+class TraceWriter {
+   public:
+    TraceWriter();
+
+    /// @brief Flushes and closes the trace.
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /// @brief Starts a new trace, the clock of the trace starts now.
+    /// @param path The trace file, replaced if it exists.
+    /// @return 0 if succeeded else -1.
+    int open(const std::string& path);
+
+    /// @brief Flushes and closes the trace.
+    void close();
+
+    /// @return A number for a new session.
+    uint32_t newSession();
+
+    /// @brief Appends one command, safe to call from many sessions at once.
+    /// @param session The session that ran the command.
+    /// @param start When the command started.
+    /// @param args The command name followed by its arguments.
+    /// @param dataSize Bytes of data the command read.
+    void record(uint32_t session, std::chrono::steady_clock::time_point start, const std::vector<StringView>& args,
+                uint64_t dataSize);
+
+   private:
+    /// @brief Appends an unsigned varint to the pending record.
+    void put(uint64_t value);
+
+    std::mutex lock;
+    std::ofstream file;
+    std::chrono::steady_clock::time_point started;
+    int64_t lastMicros;
+    std::atomic<uint32_t> sessions;
+    // Id of every command name written so far
+    std::unordered_map<std::string, uint64_t> commands;
+    // The record being built, kept to reuse its storage
+    std::string pending;
+};
+
+/// @brief Reads the records of a trace written by TraceWriter.
+class TraceReader {
+   public:
+    /// @brief Opens a trace and checks its header.
+    /// @param path The trace file.
+    /// @return 0 if succeeded else -1.
+    int open(const std::string& path);
+
+    /// @brief Reads the next record.
+    /// @param record Where to put it.
+    /// @return True if a record was read else false at the end of the trace or if the trace is damaged.
+    bool next(TraceRecord& record);
+
+   private:
+    /// @brief Reads an unsigned varint.
+    bool get(uint64_t& value);
+
+    /// @brief Reads a varint length followed by that many bytes.
+    bool get(std::string& value);
+
+    std::ifstream file;
+    int64_t lastMicros;
+    std::vector<std::string> commands;
+};
+
+#endif  // __TRACE_H__